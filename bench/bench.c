@@ -0,0 +1,430 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "dawn_format.h"
+#include "dawnc.h"
+#include "mix.h"
+#include "osc.h"
+#include "render.h"
+#include "sequencer.h"
+#include "synth.h"
+#include "workers.h"
+
+/* Dawn benchmark suite.
+
+     dawn_bench [--quick]          run every benchmark
+     dawn_bench gen C P R O [seed] write a synthetic song to stdout
+
+   Results are JSON lines on stdout, one per measurement, so runs can be
+   diffed or collected across commits. Every input is generated from a
+   fixed seed; each measurement is the best of BENCH_ROUNDS rounds, and a
+   round repeats the operation for at least min_time seconds. */
+
+#define BENCH_ROUNDS 5
+
+static double min_time = 0.2;
+static volatile float sink;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Best seconds per call of fn(arg) */
+static double measure(void (*fn)(void *), void *arg, long *iters_out) {
+    double best = 0.0;
+    long best_iters = 0;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        long iters = 0;
+        double t0 = now_seconds(), elapsed;
+        do {
+            fn(arg);
+            iters++;
+            elapsed = now_seconds() - t0;
+        } while (elapsed < min_time);
+        double per = elapsed / (double)iters;
+        if (r == 0 || per < best) {
+            best = per;
+            best_iters = iters;
+        }
+    }
+    *iters_out = best_iters;
+    return best;
+}
+
+/* ---- synthetic songs ---- */
+
+typedef struct {
+    int channels, patterns, rows, order;
+    uint32_t seed;
+    bool tonal;                /* no noise channel: every channel plays notes */
+} SongShape;
+
+static uint32_t lcg_next(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/* A deterministic song of the given shape: every channel of every pattern
+   has 'rows' one-tick rows, a mix of notes, rests and (on the last channel,
+   unless the shape is tonal) noise hits, wrapped 32 tokens to a line. */
+static void gen_song(FILE *f, const SongShape *shape) {
+    static const char *const instruments[] = { "SQUARE", "SINE", "TRIANGLE", "SAW" };
+    static const char *const letters[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+    uint32_t rng = shape->seed;
+
+    fprintf(f, "TITLE \"Bench c%d p%d r%d o%d\"\n", shape->channels, shape->patterns, shape->rows, shape->order);
+    fprintf(f, "TEMPO 150\nTPB 4\nSEED %u\nCHANNELS %d\n", shape->seed, shape->channels);
+    for (int c = 0; c < shape->channels; c++)
+        fprintf(f, "CH%d INSTR %s\n", c + 1,
+            (c == shape->channels - 1 && c > 0 && !shape->tonal) ? "NOISE" : instruments[c % 4]);
+
+    for (int p = 0; p < shape->patterns; p++) {
+        fprintf(f, "\nPATTERN %d\n", p);
+        for (int c = 0; c < shape->channels; c++) {
+            bool noise = c == shape->channels - 1 && c > 0 && !shape->tonal;
+            fprintf(f, "CH%d:", c + 1);
+            for (int r = 0; r < shape->rows; r++) {
+                if (r > 0 && r % 32 == 0) fputs(",\n   ", f);
+                uint32_t v = lcg_next(&rng);
+                if (v % 4 == 0) fputs(" -", f);
+                else if (noise) fputs(" x", f);
+                else fprintf(f, " %s%u", letters[(v >> 4) % 12], 2 + (v >> 8) % 5);
+            }
+            fputs(";\n", f);
+        }
+    }
+
+    fputs("\nORDER", f);
+    for (int i = 0; i < shape->order; i++) fprintf(f, " %u", lcg_next(&rng) % (uint32_t)shape->patterns);
+    fputc('\n', f);
+}
+
+static char bench_dir[256];
+
+static bool write_song(const SongShape *shape, const char *name, char *path, size_t path_len, long *bytes) {
+    snprintf(path, path_len, "%s/%s.dawn", bench_dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "dawn_bench: could not write %s\n", path);
+        return false;
+    }
+    gen_song(f, shape);
+    *bytes = ftell(f);
+    fclose(f);
+    return true;
+}
+
+static void shape_name(const SongShape *shape, char *buf, size_t len) {
+    snprintf(buf, len, "c%d_p%d_r%d_o%d%s", shape->channels, shape->patterns, shape->rows, shape->order,
+        shape->tonal ? "_tonal" : "");
+}
+
+/* ---- parse / load ---- */
+
+static void run_load(void *arg) {
+    DawnSong song;
+    if (!dawn_load_song((const char *)arg, &song)) exit(1);
+    sink += (float)song.row_count;
+    dawn_song_free(&song);
+}
+
+static bool bench_parse(const SongShape *shape) {
+    char name[64], path[512], cpath[520];
+    long bytes, iters;
+    shape_name(shape, name, sizeof(name));
+    if (!write_song(shape, name, path, sizeof(path), &bytes)) return false;
+
+    double sec = measure(run_load, path, &iters);
+    printf("{\"bench\":\"parse\",\"case\":\"%s\",\"bytes\":%ld,\"iters\":%ld,\"sec_per_iter\":%.9f,\"mb_per_s\":%.2f}\n",
+        name, bytes, iters, sec, (double)bytes / sec / 1e6);
+
+    DawnSong song;
+    if (!dawn_parse_file(path, &song)) return false;
+    snprintf(cpath, sizeof(cpath), "%sc", path);
+    bool ok = dawnc_write(&song, cpath);
+    dawn_song_free(&song);
+    if (!ok) return false;
+    sec = measure(run_load, cpath, &iters);
+    printf("{\"bench\":\"load_dawnc\",\"case\":\"%s\",\"source_bytes\":%ld,\"iters\":%ld,\"sec_per_iter\":%.9f,\"mb_per_s\":%.2f}\n",
+        name, bytes, iters, sec, (double)bytes / sec / 1e6);
+    return true;
+}
+
+/* ---- note names ---- */
+
+#define NOTE_NAME_COUNT 96
+static char note_names[NOTE_NAME_COUNT][8];
+
+static void run_note_names(void *arg) {
+    (void)arg;
+    float acc = 0.0f;
+    for (int i = 0; i < NOTE_NAME_COUNT; i++) acc += note_name_to_freq(note_names[i]);
+    sink += acc;
+}
+
+static void bench_note_names(void) {
+    static const char *const letters[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+    for (int i = 0; i < NOTE_NAME_COUNT; i++)
+        snprintf(note_names[i], sizeof(note_names[i]), i % 3 ? "%s%d" : "%s-%d", letters[i % 12], i / 12);
+    long iters;
+    double sec = measure(run_note_names, NULL, &iters);
+    printf("{\"bench\":\"note_name_to_freq\",\"iters\":%ld,\"ns_per_call\":%.2f,\"calls_per_s\":%.0f}\n",
+        iters * NOTE_NAME_COUNT, sec / NOTE_NAME_COUNT * 1e9, NOTE_NAME_COUNT / sec);
+}
+
+/* ---- oscillator and mix kernels ---- */
+
+#define KERNEL_BLOCKS 64
+
+typedef struct {
+    const char *name;
+    Instrument inst;
+} KernelCase;
+
+static float kernel_out[SYNTH_BLOCK_FRAMES];
+
+static void run_kernel(void *arg) {
+    const KernelCase *k = arg;
+    uint32_t phase = 0, inc = osc_phase_inc(440.0f, SYNTH_SAMPLE_RATE);
+    OscNoise ns;
+    osc_noise_seed(&ns, 1);
+    for (int b = 0; b < KERNEL_BLOCKS; b++) {
+        switch (k->inst) {
+            case INST_SINE: osc_sine(kernel_out, SYNTH_BLOCK_FRAMES, &phase, inc); break;
+            case INST_SQUARE: osc_square(kernel_out, SYNTH_BLOCK_FRAMES, &phase, inc); break;
+            case INST_TRIANGLE: osc_triangle(kernel_out, SYNTH_BLOCK_FRAMES, &phase, inc); break;
+            case INST_SAW: osc_saw(kernel_out, SYNTH_BLOCK_FRAMES, &phase, inc); break;
+            case INST_NOISE: osc_noise(kernel_out, SYNTH_BLOCK_FRAMES, &ns); break;
+        }
+        sink += kernel_out[b];
+    }
+}
+
+static void bench_oscillators(void) {
+    static const KernelCase cases[] = {
+        { "sine", INST_SINE }, { "square", INST_SQUARE }, { "triangle", INST_TRIANGLE },
+        { "saw", INST_SAW }, { "noise", INST_NOISE },
+    };
+    osc_init();
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        long iters;
+        double sec = measure(run_kernel, (void *)&cases[i], &iters);
+        double samples = (double)KERNEL_BLOCKS * SYNTH_BLOCK_FRAMES;
+        printf("{\"bench\":\"osc\",\"case\":\"%s\",\"iters\":%ld,\"samples_per_s\":%.0f}\n",
+            cases[i].name, iters, samples / sec);
+    }
+}
+
+static float mix_src[SYNTH_MIX_GROUP][SYNTH_BLOCK_FRAMES];
+static float mix_dst[SYNTH_BLOCK_FRAMES];
+
+static void run_mix(void *arg) {
+    (void)arg;
+    const float *rows[SYNTH_MIX_GROUP];
+    for (int v = 0; v < SYNTH_MIX_GROUP; v++) rows[v] = mix_src[v];
+    for (int b = 0; b < KERNEL_BLOCKS; b++) {
+        mix_sum(mix_dst, rows, SYNTH_MIX_GROUP, SYNTH_BLOCK_FRAMES, SYNTH_GAIN);
+        sink += mix_dst[b];
+    }
+}
+
+static void bench_mix(void) {
+    static const char *const isas[] = { "scalar", "sse2", "avx2" };
+    const char *native = mix_isa();
+    for (int v = 0; v < SYNTH_MIX_GROUP; v++)
+        for (int i = 0; i < SYNTH_BLOCK_FRAMES; i++) mix_src[v][i] = (float)((v * 31 + i) % 17) / 17.0f;
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (!mix_select(isas[i])) continue;
+        long iters;
+        double sec = measure(run_mix, NULL, &iters);
+        double samples = (double)KERNEL_BLOCKS * SYNTH_BLOCK_FRAMES * SYNTH_MIX_GROUP;
+        printf("{\"bench\":\"mix\",\"case\":\"%s\",\"voices\":%d,\"iters\":%ld,\"samples_per_s\":%.0f}\n",
+            isas[i], SYNTH_MIX_GROUP, iters, samples / sec);
+    }
+    mix_select(native);
+}
+
+/* ---- synth voice scaling ---- */
+
+static Synth voice_synth;
+static float voice_out[SYNTH_BLOCK_FRAMES];
+
+static void run_voices(void *arg) {
+    (void)arg;
+    for (int b = 0; b < KERNEL_BLOCKS; b++) {
+        synth_render(&voice_synth, voice_out, SYNTH_BLOCK_FRAMES);
+        sink += voice_out[b];
+    }
+}
+
+/* cost of a block should follow the voices sounding, not the pool size.
+   fx: every note gets a slow envelope, a volume and a pitch effect, so
+   each control block does real work */
+static void bench_voices(bool fx) {
+    static const int counts[] = { 1, 8, 64, 256 };
+    static const Instrument insts[] = { INST_SINE, INST_SQUARE, INST_TRIANGLE, INST_SAW };
+    static const SynthNote notes[] = {
+        { 0.7f, 60.0f, 0.0f, 1.0f, 0.5f, SYNTH_FX_VIBRATO, 5.0f, 0.5f },
+        { 0.7f, 60.0f, 0.0f, 1.0f, 0.5f, SYNTH_FX_ARPEGGIO, 4.0f, 7.0f },
+    };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        synth_init(&voice_synth, SYNTH_SAMPLE_RATE);
+        for (int v = 0; v < counts[i]; v++)
+            synth_note_on(&voice_synth, v / SYNTH_CHORD_SLOTS, v % SYNTH_CHORD_SLOTS, midi_to_freq(36 + v % 60),
+                insts[v % 4], 0, fx ? &notes[v % 2] : NULL);
+        long iters;
+        double sec = measure(run_voices, NULL, &iters);
+        double frames = (double)KERNEL_BLOCKS * SYNTH_BLOCK_FRAMES;
+        printf("{\"bench\":\"%s\",\"case\":\"%d\",\"iters\":%ld,\"frames_per_s\":%.0f,\"voice_samples_per_s\":%.0f}\n",
+            fx ? "voices_fx" : "voices", counts[i], iters, frames / sec, frames * counts[i] / sec);
+    }
+}
+
+/* ---- full offline render ---- */
+
+typedef struct {
+    DawnSong song;
+    RenderOptions opts;
+    uint64_t frames;
+    int cached_entries;
+} RenderCase;
+
+static void run_render(void *arg) {
+    RenderCase *rc = arg;
+    RenderStats stats;
+    if (!dawn_render_file(&rc->song, "/dev/null", &rc->opts, &stats)) exit(1);
+    rc->frames = stats.frames;
+    rc->cached_entries = stats.cached_entries;
+}
+
+/* threads == 0: 1, 2, 4, ... up to the online CPUs, one line each */
+static bool bench_render(const SongShape *shape, int threads, bool segments) {
+    char name[64], path[512];
+    long bytes, iters;
+    shape_name(shape, name, sizeof(name));
+    if (!write_song(shape, name, path, sizeof(path), &bytes)) return false;
+
+    RenderCase rc = { .frames = 0 };
+    if (!dawn_parse_file(path, &rc.song)) return false;
+    int first = threads ? threads : 1;
+    int last = threads ? threads : workers_cpu_count();
+    for (int t = first; t <= last; t *= 2) {
+        rc.opts.threads = t;
+        rc.opts.segments = segments;
+        double sec = measure(run_render, &rc, &iters);
+        printf("{\"bench\":\"render\",\"case\":\"%s\",\"split\":\"%s\",\"threads\":%d,\"frames\":%llu,"
+            "\"iters\":%ld,\"sec_per_iter\":%.9f,\"samples_per_s\":%.0f,\"realtime_x\":%.1f}\n",
+            name, segments ? "segments" : "voices", t, (unsigned long long)rc.frames, iters, sec, (double)rc.frames / sec,
+            (double)rc.frames / SYNTH_SAMPLE_RATE / sec);
+    }
+    dawn_song_free(&rc.song);
+    return true;
+}
+
+/* Loop-heavy song with and without the rendered-pattern cache */
+static bool bench_render_cache(const SongShape *shape) {
+    char name[64], path[512];
+    long bytes, iters;
+    shape_name(shape, name, sizeof(name));
+    if (!write_song(shape, name, path, sizeof(path), &bytes)) return false;
+
+    RenderCase rc = { .frames = 0 };
+    if (!dawn_parse_file(path, &rc.song)) return false;
+    for (int on = 0; on <= 1; on++) {
+        rc.opts.pattern_cache_mb = on ? 0 : -1;
+        double sec = measure(run_render, &rc, &iters);
+        printf("{\"bench\":\"render_cache\",\"case\":\"%s\",\"cache\":%s,\"frames\":%llu,\"cached_entries\":%d,"
+            "\"iters\":%ld,\"sec_per_iter\":%.9f,\"realtime_x\":%.1f}\n",
+            name, on ? "true" : "false", (unsigned long long)rc.frames, rc.cached_entries, iters, sec,
+            (double)rc.frames / SYNTH_SAMPLE_RATE / sec);
+    }
+    dawn_song_free(&rc.song);
+    return true;
+}
+
+static void remove_bench_dir(void) {
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", bench_dir);
+    if (system(cmd) != 0) fprintf(stderr, "dawn_bench: could not remove %s\n", bench_dir);
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--quick]\n", prog);
+    fprintf(stderr, "       %s gen CHANNELS PATTERNS ROWS ORDER [SEED] > song.dawn\n", prog);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0) {
+        if (argc < 6) return usage(argv[0]);
+        SongShape shape = { atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+                            argc > 6 ? (uint32_t)strtoul(argv[6], NULL, 10) : 1u, false };
+        if (shape.channels < 1 || shape.channels > DAWN_MAX_CHANNELS || shape.patterns < 1 ||
+            shape.patterns > DAWN_MAX_PATTERNS || shape.rows < 1 || shape.rows > DAWN_MAX_PATTERN_ROWS ||
+            shape.order < 1 || shape.order > DAWN_MAX_ORDER) {
+            fprintf(stderr, "dawn_bench: song shape out of range\n");
+            return 1;
+        }
+        gen_song(stdout, &shape);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) min_time = 0.02;
+        else return usage(argv[0]);
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(bench_dir, sizeof(bench_dir), "%s/dawn-bench-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(bench_dir)) {
+        fprintf(stderr, "dawn_bench: could not create %s\n", bench_dir);
+        return 1;
+    }
+
+    printf("{\"bench\":\"meta\",\"mix_isa\":\"%s\",\"sample_rate\":%d,\"block_frames\":%d,\"rounds\":%d,\"min_time\":%.3f}\n",
+        mix_isa(), SYNTH_SAMPLE_RATE, SYNTH_BLOCK_FRAMES, BENCH_ROUNDS, min_time);
+
+    static const SongShape parse_shapes[] = {
+        { 4, 8, 32, 16, 1, false },
+        { 8, 64, 64, 256, 2, false },
+        { 8, 256, 512, 1024, 3, false },
+    };
+    static const SongShape render_shapes[] = {
+        { 4, 8, 64, 16, 4, false },
+        { 8, 8, 64, 16, 5, false },
+    };
+    /* enough voices to share out: thread scaling */
+    static const SongShape dense_shape = { 32, 8, 64, 16, 6, false };
+    /* few patterns, long ORDER: the pattern cache. An entry is only copied
+       when it starts from a synth state seen before, and a note sounding
+       into it, on any channel, brings its phase (or noise stream) along:
+       mostly only entries that every channel enters from a rest repeat.
+       One channel, and four without noise; the noise channel rarely rests
+       and keeps the default wider shapes from ever repeating. */
+    static const SongShape loop_shapes[] = {
+        { 1, 4, 64, 64, 7, false },
+        { 4, 4, 64, 64, 7, true },
+    };
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < sizeof(parse_shapes) / sizeof(parse_shapes[0]); i++) ok = bench_parse(&parse_shapes[i]);
+    if (ok) {
+        bench_note_names();
+        bench_oscillators();
+        bench_mix();
+        bench_voices(false);
+        bench_voices(true);
+    }
+    for (size_t i = 0; ok && i < sizeof(render_shapes) / sizeof(render_shapes[0]); i++) ok = bench_render(&render_shapes[i], 1, false);
+    if (ok) ok = bench_render(&dense_shape, 0, false);
+    if (ok) ok = bench_render(&dense_shape, 0, true);
+    for (size_t i = 0; ok && i < sizeof(loop_shapes) / sizeof(loop_shapes[0]); i++) ok = bench_render_cache(&loop_shapes[i]);
+    fflush(stdout);
+
+    remove_bench_dir();
+    return ok ? 0 : 1;
+}
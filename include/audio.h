@@ -2,26 +2,79 @@
 #define AUDIO_H
 
 #include <SDL2/SDL.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "synth.h" /* provides Instrument, SynthEvent */
 
-typedef enum {
-    INST_SINE = 1,
-    INST_SQUARE,
-    INST_TRIANGLE,
-    INST_SAW,
-    INST_NOISE
-} Instrument;
+/* Device request defaults; 256 frames is ~5.8 ms at 44.1 kHz */
+#define AUDIO_DEFAULT_SAMPLE_RATE SYNTH_SAMPLE_RATE
+#define AUDIO_DEFAULT_CHANNELS 1
+#define AUDIO_DEFAULT_BUFFER_FRAMES 256
 
+#define AUDIO_MIN_SAMPLE_RATE 8000
+#define AUDIO_MAX_SAMPLE_RATE 192000
+#define AUDIO_MAX_CHANNELS 8
+#define AUDIO_MIN_BUFFER_FRAMES 32
+#define AUDIO_MAX_BUFFER_FRAMES 32768
+
+/* Output device format and engine settings. Fields left 0 in a request
+   take the defaults. */
 typedef struct {
-    int active;
-    float frequency;
-    Instrument instrument;
-    float phase;
-} Channel;
+    int sample_rate;
+    int channels;      /* interleaved output channels; every one carries the mono mix */
+    int buffer_frames; /* frames per device callback */
+    int voices;        /* synth voice pool, 1..SYNTH_MAX_VOICES */
+} AudioConfig;
+
+/* load histogram: callback time as a share of its budget (the time the
+   buffer takes to play), in 10% steps; the last bucket is >= 100% */
+#define AUDIO_STATS_BUCKETS 11
 
-void audio_init(void);
+/* Callback timing, recorded lock-free on the audio thread */
+typedef struct {
+    uint64_t callbacks;
+    uint64_t frames;
+    uint64_t budget_ns;         /* budget of the most recent callback */
+    uint64_t total_ns;          /* time spent inside the callback */
+    uint64_t worst_ns;
+    uint64_t worst_budget_ns;   /* budget of the worst callback */
+    uint64_t underruns;         /* callbacks that ran past their budget */
+    uint64_t late_events;       /* events applied after their frame */
+    uint64_t worst_late_frames;
+    uint64_t load_histogram[AUDIO_STATS_BUCKETS];
+} AudioStats;
+
+/* Open the default device as close to *want as it allows (want may be
+   NULL). The obtained format is used as is: the synth runs at the device
+   rate so SDL never resamples. *have (may be NULL) receives it. */
+bool audio_init(const AudioConfig *want, AudioConfig *have);
 void audio_shutdown(void);
+
+/* The format the device was opened with */
+const AudioConfig *audio_config(void);
 void audio_set_channel(int id, float freq, Instrument inst);
 void audio_stop_channel(int id);
 
+/* Queue an event for the audio thread, applied at exactly ev->frame.
+   Events must be scheduled in non-decreasing frame order.
+   Returns false if the queue is full (retry later). */
+bool audio_schedule(const SynthEvent *ev);
+
+/* Drop every event queued so far that the audio thread has not applied
+   yet; the next callback starts without them. Call from the thread that
+   schedules, then schedule the replacements. */
+void audio_flush(void);
+
+/* Channels (bit c for song channel c) to leave out of the mix from the
+   next callback on; their notes keep running underneath */
+void audio_set_muted(uint32_t mask);
+
+/* Output clock: frames handed to the device so far */
+uint64_t audio_frames_played(void);
+
+/* Consistent snapshot of the callback statistics; callable from any thread */
+void audio_get_stats(AudioStats *out);
+void audio_print_stats(FILE *f, const AudioStats *stats);
+
 #endif
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "render.h"
+
+/* Render many songs in one process. Songs are dealt out to per-thread
+   queues, largest file first; a thread that runs dry steals from the
+   others, so one long song never holds up a queue of short ones. */
+
+typedef struct {
+    const char *out_dir;    /* created if missing */
+    int jobs;               /* worker threads, 0 = one per CPU */
+    RenderOptions render;   /* for every song; each song renders on one thread.
+                               A disk_cache is shared by all threads */
+} BatchOptions;
+
+typedef struct {
+    int songs;
+    int failed;
+    int cached;             /* copied from the render cache */
+    int jobs;               /* threads used */
+    uint64_t frames;        /* rendered by the songs that succeeded */
+    double audio_seconds;
+    double elapsed;         /* wall clock for the whole batch */
+} BatchStats;
+
+/* source is a directory (every .dawn and .dawnc file in it; of name.dawn
+   and name.dawnc only the newer) or a text file listing one song path per
+   line. Each song is rendered to out_dir/<name>.wav. A song that fails to
+   load or render, or whose output name an earlier song (by path) already
+   has, is reported on stderr and counted; the rest of the batch carries on. Returns false only
+   if the batch could not run at all (unreadable source, no out_dir). */
+bool batch_render(const char *source, const BatchOptions *opts, BatchStats *stats);
+
+#endif
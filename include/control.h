@@ -0,0 +1,63 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dawn_format.h"
+#include "reload.h"
+
+/* Live control of playback from other local processes. A thread serves a
+   Unix-domain stream socket; clients send one command per line and get
+   "ok" or "error: ..." back:
+
+       play                  resume (from the top after the song ended)
+       stop                  release every note and hold the position
+       seek ORDER            jump to an ORDER entry (0-based)
+       seek-time SEC         jump to a time, at the current tempo
+       tempo BPM             change the opening TEMPO, keeping the position
+       mute CH / unmute CH   channels as in the song, CH1 = 1
+       solo CH / unsolo CH   with any channel soloed only those are heard
+       pattern ID CHn: ROWS  replace a pattern channel, rows as in a .dawn file
+       quit                  end playback
+
+   Commands are checked and prepared on the socket thread, then passed to
+   the player through a single-producer/single-consumer ring, so neither
+   side ever waits on the other. Tempo and pattern commands edit the
+   socket thread's copy of the song and compile it (with a seek index)
+   there, so the player only has to switch over. Mute and solo skip the
+   player: they go straight to the audio callback (audio_set_muted()). */
+
+#define CONTROL_QUEUE_CAPACITY 64   /* must be a power of two */
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_MAX 65536      /* longest command line, pattern rows included */
+
+typedef struct Controller Controller;
+
+typedef enum {
+    CONTROL_PLAY,
+    CONTROL_STOP,
+    CONTROL_SEEK_ORDER,
+    CONTROL_SEEK_TIME,
+    CONTROL_SONG,          /* an edited song to play on in, at the same place */
+    CONTROL_QUIT
+} ControlType;
+
+typedef struct {
+    ControlType type;
+    int order;             /* SEEK_ORDER */
+    double seconds;        /* SEEK_TIME */
+    ReloadedSong *song;    /* SONG: freed by the receiver */
+} ControlCommand;
+
+/* Listen on socket_path (a stale socket there is replaced). Takes
+   ownership of 'song', the one playing; edits are compiled at
+   sample_rate, indexed for 'voices'. NULL (with a message) if the socket
+   cannot be set up; the song is freed either way. */
+Controller *control_start(const char *socket_path, DawnSong *song, int sample_rate, int voices);
+void control_stop(Controller *c);
+
+/* Player side, never blocks. pending() only looks. */
+bool control_pending(Controller *c);
+bool control_poll(Controller *c, ControlCommand *out);
+
+#endif
@@ -2,42 +2,138 @@
 #define DAWN_FORMAT_H
 
 #include <stdbool.h>
-#include "sequencer.h" /* provides NoteEvent, Instrument, note_name_to_freq */
+#include <stddef.h>
+#include <stdint.h>
+#include "sequencer.h" /* provides Instrument, note_name_to_midi, midi_to_freq */
 
-#define DAWN_MAX_CHANNELS 8
-#define DAWN_MAX_PATTERNS 64
-#define DAWN_MAX_PATTERN_ROWS 256
-#define DAWN_MAX_ORDER 256
+#define DAWN_MAX_CHANNELS 32
+#define DAWN_MAX_CHORD 8              /* notes per row, e.g. C4/E4/G4 */
+#define DAWN_MAX_PATTERNS 4096        /* pattern ids are 0 .. DAWN_MAX_PATTERNS-1 */
+#define DAWN_MAX_PATTERN_ROWS 65535   /* per channel per pattern */
+#define DAWN_MAX_ORDER 65536
 #define DAWN_MAX_TITLE_LEN 128
+#define DAWN_MAX_TEMPO_CHANGES 65536
 
+#define DAWN_NOTE_REST 0 /* note number for rows without a pitch (rests, noise hits) */
+#define DAWN_VOLUME_MAX 100 /* volumes are percentages */
+
+/* Tracker-style effect of a row, written after the note: C4:g4, C4:~52, C4:a47 */
+typedef enum {
+    DAWN_FX_NONE,
+    DAWN_FX_PORTAMENTO, /* gN: slide from the previous pitch over N ticks */
+    DAWN_FX_VIBRATO,    /* ~xy: x Hz, y quarter-semitones deep (hex digits) */
+    DAWN_FX_ARPEGGIO    /* axy: cycle note, +x, +y semitones (hex digits) */
+} DawnEffect;
+
+/* One pattern row, packed into 8 bytes. A chord is stored as consecutive
+   rows: its first note, then one DAWN_ROW_CHORD row per further note. */
+typedef struct {
+    uint8_t note;          /* MIDI note number, or DAWN_NOTE_REST */
+    uint8_t instr;         /* Instrument, | DAWN_ROW_CHORD */
+    uint16_t length_ticks; /* 0 == one tick; chord rows take the first note's */
+    uint8_t volume;        /* vN, 0..DAWN_VOLUME_MAX; scales the channel's VOLUME */
+    uint8_t effect;        /* DawnEffect */
+    uint8_t param;         /* effect parameter; xy effects keep x in the high nibble */
+    uint8_t reserved;      /* 0 */
+} DawnNote;
+
+#define DAWN_ROW_CHORD 0x80 /* sounds with the row before it instead of after */
+#define DAWN_ROW_INSTR(row) ((Instrument)((row)->instr & ~DAWN_ROW_CHORD))
+
+/* How a channel's notes sound: CHn ADSR a d s r, CHn VOLUME v. Times are
+   milliseconds, levels percentages. The defaults (0 0 100 0, volume 100)
+   are plain on/off notes. */
+typedef struct {
+    uint16_t attack_ms;
+    uint16_t decay_ms;
+    uint16_t release_ms;   /* after note-off; 0 cuts the note dead */
+    uint8_t sustain;
+    uint8_t volume;
+} DawnVoice;
+
+/* TEMPO bpm AT entry[:tick] [RAMP n]: from 'tick' ticks into ORDER entry
+   'order' the tempo is bpm, or with a ramp it goes there linearly over n
+   ticks from whatever it was. The tick may run past the entry's end, into
+   the entries after it. Changes at the same point apply in file order. */
+typedef struct {
+    uint32_t order;
+    uint32_t tick;
+    uint32_t ramp_ticks;   /* 0: a step */
+    uint32_t bpm;
+} DawnTempoChange;
+
+/* Rows of one channel of one pattern: rows[first_row .. first_row+row_count) */
 typedef struct {
-    int channel;         /* 0-based */
-    int row_count;
-    NoteEvent rows[DAWN_MAX_PATTERN_ROWS];
-} DawnPatternChannel;
+    uint32_t first_row;
+    uint32_t row_count;
+} DawnChannelData;
 
+/* Channel c of a pattern is channels[first_channel + c], for c < channel_count */
 typedef struct {
-    int id;
-    int channel_count; /* number of channels defined in this pattern (<= DAWN_MAX_CHANNELS) */
-    DawnPatternChannel channels[DAWN_MAX_CHANNELS];
+    int32_t id;
+    uint32_t first_channel;
 } DawnPattern;
 
+/* A parsed song. Everything variable-sized lives in one arena allocation
+   and is addressed by offsets, so a song costs roughly what it contains. */
 typedef struct {
     char title[DAWN_MAX_TITLE_LEN];
     int bpm;
     int ticks_per_beat;
     int channel_count; /* how many channels in this song */
+    uint32_t seed;     /* noise seed: SEED n, or derived from the title */
+
+    /* preferred output format (RATE, OUTPUT_CHANNELS, BUFFER); 0 if unset */
+    int sample_rate;
+    int output_channels;
+    int buffer_frames;
 
     Instrument channel_instruments[DAWN_MAX_CHANNELS];
+    DawnVoice channel_voices[DAWN_MAX_CHANNELS];
 
     int order_length;
-    int order[DAWN_MAX_ORDER]; /* pattern ids */
+    int32_t *order;            /* pattern ids */
+
+    int tempo_change_count;
+    DawnTempoChange *tempo_changes; /* in file order; TEMPO (bpm) holds until the first */
 
     int pattern_count;
-    DawnPattern patterns[DAWN_MAX_PATTERNS];
+    DawnPattern *patterns;
+    DawnChannelData *channels; /* pattern_count * channel_count */
+    uint32_t row_count;
+    DawnNote *rows;
+
+    int pattern_id_limit;      /* pattern_index covers ids 0 .. pattern_id_limit-1 */
+    int32_t *pattern_index;    /* pattern id -> index into patterns, -1 if undefined */
+
+    void *arena;               /* backs every pointer above */
+    size_t arena_size;
+    bool arena_mapped;         /* arena is a mapped .dawnc image (see dawnc.h) */
 } DawnSong;
 
-/* Parse a .dawn file and fill DawnSong. Returns true on success. */
+/* Parse a .dawn file and fill DawnSong. Returns true on success.
+   Pattern ids are resolved here: duplicate ids and ORDER entries that name
+   an undefined pattern are load errors, as are tempo changes at ORDER
+   entries the song does not have. Release with dawn_song_free(). */
 bool dawn_parse_file(const char *filename, DawnSong *out_song);
 
+void dawn_song_free(DawnSong *song);
+
+/* O(1) lookup by pattern id; NULL if the song has no such pattern */
+const DawnPattern *dawn_song_pattern(const DawnSong *song, int id);
+
+/* Rows of channel c in pat; *row_count receives their number */
+const DawnNote *dawn_pattern_rows(const DawnSong *song, const DawnPattern *pat, int c, uint32_t *row_count);
+
+/* Parse one channel's rows as written after "CHn:" in a pattern, e.g.
+   "C4 - E4:g2 C4/E4/G4"; rows without an instrument take default_instr.
+   *rows is malloc'd. False (with a message) on a bad token. */
+bool dawn_parse_rows(const char *text, Instrument default_instr, DawnNote **rows, uint32_t *row_count);
+
+/* Build 'out' as a copy of 'song' with channel c of pattern 'id' holding
+   'rows' instead. False if there is no such pattern or channel, or on
+   allocation failure. Release with dawn_song_free(). */
+bool dawn_song_replace_rows(const DawnSong *song, int id, int c, const DawnNote *rows, uint32_t row_count,
+                            DawnSong *out);
+
 #endif
@@ -0,0 +1,44 @@
+#ifndef DAWNC_H
+#define DAWNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dawn_format.h"
+
+/* .dawnc: a validated song saved as a little-endian binary image.
+
+   [0]   magic "DAWC"
+   [4]   u32 format version (DAWNC_VERSION)
+   [8]   u64 FNV-1a 64 checksum of bytes [16, file_size)
+   [16]  u64 file_size
+   [24]  song header (tempo, channels, counts, section offsets, title,
+         preferred output format, channel envelopes and volumes)
+   [512] sections, in DawnSong arena order:
+         patterns, channels, order, tempo changes, pattern_index, rows
+
+   The sections have the same layout as a parsed DawnSong's arena, so on
+   little-endian hosts loading is one mmap, a header and checksum check,
+   and pointer setup; the song then reads straight from the mapping. */
+
+#define DAWNC_MAGIC "DAWC"
+#define DAWNC_VERSION 5
+#define DAWNC_HEADER_SIZE 512
+
+/* Serialize to a malloc'd image; *size receives its length */
+void *dawnc_serialize(const DawnSong *song, size_t *size);
+
+/* Write the image atomically (temp file + rename) */
+bool dawnc_write(const DawnSong *song, const char *path);
+
+/* Load an image; refuses other versions and images whose checksum or
+   structure does not verify. Release with dawn_song_free(). */
+bool dawnc_load(const char *path, DawnSong *out);
+
+/* true if the file starts with the .dawnc magic */
+bool dawnc_is_compiled(const char *path);
+
+/* Load a song from either a .dawn text file or a .dawnc image */
+bool dawn_load_song(const char *path, DawnSong *out);
+
+#endif
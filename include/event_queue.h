@@ -0,0 +1,34 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "synth.h" /* provides SynthEvent */
+
+#define EVENT_QUEUE_CAPACITY 4096 /* must be a power of two */
+
+/* Wait-free single-producer/single-consumer ring.
+   The control thread pushes, the audio thread peeks/pops; neither ever blocks.
+   head/tail are free-running counters, so full/empty need no spare slot. */
+typedef struct {
+    _Atomic size_t head; /* next slot to read (consumer-owned) */
+    _Atomic size_t tail; /* next slot to write (producer-owned) */
+    _Atomic size_t drop; /* events before this one are discarded unread (producer-owned) */
+    SynthEvent events[EVENT_QUEUE_CAPACITY];
+} EventQueue;
+
+void event_queue_init(EventQueue *q);
+
+/* producer side: returns false if the ring is full */
+bool event_queue_push(EventQueue *q, const SynthEvent *ev);
+
+/* producer side: take back everything pushed so far. The consumer skips
+   those events at its next peek; events pushed afterwards are kept. */
+void event_queue_flush(EventQueue *q);
+
+/* consumer side: peek returns NULL if empty; the pointer stays valid until pop */
+const SynthEvent *event_queue_peek(EventQueue *q);
+void event_queue_pop(EventQueue *q);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stdbool.h>
+
+/* Block mixing kernels with runtime CPU dispatch (scalar, SSE2, AVX2).
+   All variants add in the same order with the same operations, so output
+   is bit-identical whichever one the CPU gets. */
+
+/* dst[i] = src[0][i]*gain + src[1][i]*gain + ... (summed in ascending k);
+   count == 0 clears dst */
+void mix_sum(float *dst, const float *const *src, int count, int n, float gain);
+
+/* Continue a mix_sum() with more rows: dst[i] += src[0][i]*gain + ...
+   Mixing rows in several calls gives the same result as one call over
+   all of them. */
+void mix_sum_add(float *dst, const float *const *src, int count, int n, float gain);
+
+/* Linear gain ramp: buf[i] *= from + step * (first + i). The gain is
+   computed from i, never accumulated, so a ramp split into several calls
+   (with first advanced to match) scales exactly like one call. */
+void mix_ramp(float *buf, int n, float from, float step, int first);
+
+/* name of the kernel in use: "scalar", "sse2" or "avx2" */
+const char *mix_isa(void);
+
+/* force a kernel by name (benchmarks/tests); false if the CPU lacks it */
+bool mix_select(const char *name);
+
+#endif
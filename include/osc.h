@@ -0,0 +1,38 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <stdint.h>
+
+/* Oscillator kernels. Phase is a 32-bit fixed-point fraction of a cycle
+   (2^32 == one period) that wraps for free, so long notes never lose
+   precision. Each kernel fills out[0..n) with one voice's raw waveform in
+   [-1, 1] and advances *phase by n * inc. */
+
+#define OSC_SINE_TABLE_BITS 11
+#define OSC_SINE_TABLE_SIZE (1 << OSC_SINE_TABLE_BITS)
+
+/* Builds the sine table; safe to call any number of times from any thread */
+void osc_init(void);
+
+/* phase increment per frame for freq at sample_rate */
+uint32_t osc_phase_inc(float freq, int sample_rate);
+
+void osc_sine(float *out, int n, uint32_t *phase, uint32_t inc);
+void osc_square(float *out, int n, uint32_t *phase, uint32_t inc);
+void osc_triangle(float *out, int n, uint32_t *phase, uint32_t inc);
+void osc_saw(float *out, int n, uint32_t *phase, uint32_t inc);
+
+/* Noise: counter-based generator, sample k of a stream is a hash of
+   (seed, k) in the splitmix/PCG output-function family. Samples do not
+   depend on each other, so the fill is vectorized, the stream is the same
+   however it is split into calls, and any position can be jumped to by
+   setting counter. */
+typedef struct {
+    uint32_t seed;
+    uint32_t counter;
+} OscNoise;
+
+void osc_noise_seed(OscNoise *ns, uint32_t seed);
+void osc_noise(float *out, int n, OscNoise *ns);
+
+#endif
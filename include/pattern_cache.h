@@ -0,0 +1,44 @@
+#ifndef PATTERN_CACHE_H
+#define PATTERN_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "timeline.h"
+
+/* Rendered ORDER entries, for songs that play the same pattern again and
+   again. An entry's audio is fixed by the synth state it starts from and
+   its events, so a repeat that starts from the same state can replay the
+   stored samples and jump to the stored end state instead of rendering.
+   Bounded in bytes; the least recently used entries make room. */
+
+typedef struct PatternCache PatternCache;
+
+/* What an entry's audio depends on */
+typedef struct {
+    int pattern;
+    uint64_t frames;               /* entry length */
+    const TimelineEvent *events;   /* frames relative to the entry start */
+    int event_count;
+    const void *state;             /* synth_snapshot() at the start, after synth_renumber() */
+    size_t state_size;
+} PatternKey;
+
+typedef struct {
+    const float *pcm;              /* key.frames mono samples */
+    const void *end_state;         /* synth_snapshot() at the entry end */
+} PatternBlock;
+
+/* NULL on allocation failure */
+PatternCache *pattern_cache_create(size_t max_bytes);
+void pattern_cache_destroy(PatternCache *c);
+
+/* The stored entry for key, or NULL. Valid until the next pattern_cache_add(). */
+const PatternBlock *pattern_cache_find(PatternCache *c, const PatternKey *key);
+
+/* Store copies of key, pcm and end_state, evicting as needed. False if the
+   entry is larger than the whole cache or memory runs out. */
+bool pattern_cache_add(PatternCache *c, const PatternKey *key, const float *pcm, const void *end_state,
+                       size_t end_size);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <stdbool.h>
+#include "dawn_format.h"
+#include "seek.h"
+#include "timeline.h"
+
+/* Hot reload for playback. A background thread watches the song file
+   (inotify on its directory, so editors that save by renaming are seen
+   too), re-loads it after every save, compares it with the song it last
+   saw, and when patterns, ORDER or song settings changed compiles a new
+   timeline and hands it over. The player picks it up at an ORDER boundary
+   with reload_take(); nothing here touches the audio thread. */
+
+typedef struct Reloader Reloader;
+
+/* A song ready to swap in */
+typedef struct {
+    Timeline tl;
+    SeekIndex ix;          /* built only if asked for at reload_start() */
+    bool has_index;
+} ReloadedSong;
+
+/* Takes ownership of 'song' (the one playing), the baseline for the
+   first comparison. New songs are compiled at sample_rate; with 'index',
+   a seek index for 'voices' is built as well. NULL (with a message) if
+   the file cannot be watched; the song is freed either way. */
+Reloader *reload_start(const char *path, DawnSong *song, int sample_rate, int voices, bool index);
+void reload_stop(Reloader *rl);
+
+/* The newest song not yet taken, or NULL; never blocks. Older ones that
+   were never taken are dropped. Release with reloaded_song_free(). */
+ReloadedSong *reload_take(Reloader *rl);
+void reloaded_song_free(ReloadedSong *s);
+
+#endif
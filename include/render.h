@@ -0,0 +1,61 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dawn_format.h"
+#include "render_cache.h"
+
+#define RENDER_BLOCK_FRAMES 4096
+#define RENDER_MAX_CHANNELS 8
+#define PATTERN_CACHE_MB 64    /* rendered-pattern cache, see RenderOptions */
+
+typedef enum {
+    RENDER_F32,        /* 32-bit float */
+    RENDER_S16         /* 16-bit signed, clipped to [-1, 1] */
+} RenderFormat;
+
+/* Zero fields take the defaults */
+typedef struct {
+    int sample_rate;   /* the song's RATE, or SYNTH_SAMPLE_RATE */
+    int voices;        /* synth voice pool, SYNTH_MAX_VOICES */
+    int threads;       /* worker threads, 1 */
+    bool segments;     /* threads take whole stretches of the song (cut at
+                          ORDER entries) instead of sharing out the voices */
+    int channels;      /* interleaved copies of the mono mix, 1 */
+    RenderFormat format;
+    int pattern_cache_mb; /* memory for rendered ORDER entries that repeat,
+                             PATTERN_CACHE_MB; negative turns the cache off */
+    RenderCache *disk_cache;  /* finished renders on disk, none */
+} RenderOptions;
+
+typedef struct {
+    uint64_t frames;   /* frames written */
+    int sample_rate;
+    uint64_t voices_stolen;
+    int threads;
+    int cached_entries; /* ORDER entries copied from the pattern cache */
+    bool from_disk_cache; /* the whole output was copied from the disk cache */
+} RenderStats;
+
+/* Render the song offline, as fast as the CPU allows (no SDL, no sleeping).
+   A path ending in ".wav" gets a WAV header; anything else is written as
+   headerless little-endian interleaved samples. opts may be NULL.
+   With several threads each one renders a share of the sounding voices and
+   the rows are mixed in the same order as on one thread; with segments the
+   threads render separate stretches of the song, each started from the
+   exact synth state at its first frame. Either way the output does not
+   depend on the thread count or the mode. Without segments, an ORDER entry
+   that repeats one already rendered from the same synth state is copied
+   from the pattern cache rather than rendered again, with the same
+   result. With a disk cache, a song rendered before with the same
+   settings is copied from it instead. Returns true on success. */
+bool dawn_render_file(const DawnSong *song, const char *path, const RenderOptions *opts, RenderStats *stats);
+
+/* Same, as raw samples to an open stream (a pipe, stdout), one block at a
+   time: memory use does not grow with the song, and a consumer that reads
+   slowly simply blocks the render. fp is flushed, not closed. */
+bool dawn_render_stream(const DawnSong *song, FILE *fp, const RenderOptions *opts, RenderStats *stats);
+
+#endif
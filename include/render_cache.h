@@ -0,0 +1,66 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dawn_format.h"
+
+/* On-disk cache of finished renders, for jobs that render the same songs
+   again and again. An entry is addressed by a 128-bit hash of the
+   compiled song (its .dawnc image), the engine version and every output
+   setting, and holds the exact bytes the render wrote (WAV or raw).
+   Entries are written to a temp file, synced and renamed into place, so
+   readers never see half an entry, even after a crash, and any number of threads or processes can
+   share a directory. Past the size cap the entries used least recently
+   (by modification time, refreshed on every hit) are removed. */
+
+/* Bump whenever a change alters rendered samples: old entries then stop
+   matching instead of being served. */
+#define RENDER_ENGINE_VERSION 1
+#define RENDER_CACHE_DEFAULT_MB 1024
+
+typedef struct RenderCache RenderCache;
+typedef struct RenderCacheEntry RenderCacheEntry;
+
+typedef struct {
+    uint64_t hash[2];
+    uint64_t song_bytes;     /* size of the .dawnc image, checked on a hit too */
+    uint32_t frame_bytes;    /* output bytes per frame ... */
+    uint32_t header_bytes;   /* ... and before the first (a WAV header): with
+                                the stored frame count, the expected length */
+} RenderCacheKey;
+
+/* What a hit reports in place of the render's own stats */
+typedef struct {
+    uint64_t frames;
+    uint64_t voices_stolen;
+    int sample_rate;
+} RenderCacheInfo;
+
+/* dir is created if missing. NULL (with a message) if it cannot be used. */
+RenderCache *render_cache_open(const char *dir, uint64_t max_bytes);
+void render_cache_close(RenderCache *c);
+
+/* Settings are the effective ones, defaults already applied; sample_bytes
+   is the size of one sample in 'format' */
+bool render_cache_key(const DawnSong *song, int sample_rate, int voices, int channels, int format, int sample_bytes,
+                      bool wav, RenderCacheKey *key);
+
+/* On a hit, copy the stored output to fp, fill info and return true. A
+   miss writes nothing; an entry whose length does not match its header
+   (truncated or damaged) is a miss and is removed. *failed is set if the
+   copy broke off part way. */
+bool render_cache_fetch(RenderCache *c, const RenderCacheKey *key, FILE *fp, RenderCacheInfo *info, bool *failed);
+
+/* Start an entry. Write exactly the output's bytes to
+   render_cache_entry_file(), which starts at offset 0 as far as the
+   writer is concerned (render_cache_entry_seek()), then commit or
+   discard. NULL if the directory cannot be written: render uncached. */
+RenderCacheEntry *render_cache_begin(RenderCache *c, const RenderCacheKey *key);
+FILE *render_cache_entry_file(RenderCacheEntry *e);
+bool render_cache_entry_seek(RenderCacheEntry *e, long offset);
+void render_cache_commit(RenderCacheEntry *e, const RenderCacheInfo *info);
+void render_cache_discard(RenderCacheEntry *e);
+
+#endif
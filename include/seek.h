@@ -0,0 +1,38 @@
+#ifndef SEEK_H
+#define SEEK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "synth.h"
+#include "timeline.h"
+
+/* Random access into a compiled song. One pass over the timeline (skipping
+   the audio, as the segmented renderer does) records, for every ORDER
+   entry, its first event and a snapshot of the synth at its start. Any
+   position is then reached by a binary search for its ORDER entry, a
+   snapshot restore and the events of that one entry. */
+typedef struct {
+    const Timeline *tl;      /* must outlive the index */
+    int *first_event;        /* per ORDER entry: first event at or after its start */
+    size_t *state_offset;    /* per ORDER entry: its synth_snapshot() in states */
+    unsigned char *states;
+} SeekIndex;
+
+/* voices: the pool size playback will use (0 = SYNTH_MAX_VOICES), since
+   it decides which notes get stolen. False (with a message) on allocation failure. */
+bool seek_index_build(SeekIndex *ix, const Timeline *tl, int voices);
+void seek_index_free(SeekIndex *ix);
+
+/* The ORDER entry playing at 'frame' (0 if the song has none) */
+int seek_order_at(const SeekIndex *ix, uint64_t frame);
+
+/* Synth snapshot at the start of ORDER entry 'order', before its events */
+const void *seek_order_state(const SeekIndex *ix, int order);
+
+/* Put s (at the timeline's sample rate) where a render from the song start
+   is at 'frame', before that frame's events: same notes held, same phases.
+   Returns the index of the first event still to apply. */
+int seek_synth(const SeekIndex *ix, uint64_t frame, Synth *s);
+
+#endif
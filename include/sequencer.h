@@ -2,7 +2,7 @@
 #define SEQUENCER_H
 
 #include <stdint.h>
-#include "audio.h"
+#include "synth.h" /* provides Instrument */
 
 #define DAWN_CHANNELS 8
 #define TICKS_PER_BEAT 96
@@ -24,42 +24,66 @@ typedef struct {
     NoteEvent rows[MAX_PATTERN_ROWS];
 } Pattern;
 
+/* A pattern as stored by the sequencer: its rows are rows[first_row .. first_row+row_count) */
+typedef struct {
+    int id;
+    int row_count;
+    int first_row;
+} SequencerPattern;
+
 /* Sequencer / song container */
 typedef struct {
     int bpm;
     int ticks_per_beat;
     double seconds_per_tick;
 
-    Pattern patterns[MAX_PATTERNS];
+    SequencerPattern patterns[MAX_PATTERNS];
     int pattern_count;
 
+    /* rows of every added pattern, packed back to back */
+    NoteEvent *rows;
+    int row_count;
+    int row_cap;
+
     int order[MAX_ORDER];     /* pattern ids in order */
     int order_length;
 
     /* per-channel playback pointers/state */
     int channel_pos[DAWN_CHANNELS];      /* current row index in pattern */
     int channel_remaining_ticks[DAWN_CHANNELS];
+    int channel_idle[DAWN_CHANNELS];     /* past its rows and already stopped */
 
     /* song playback pointers */
     int order_index;    /* which order entry is playing */
     int current_pattern_id;
+    SequencerPattern *current_pattern; /* resolved once per order entry, not per tick */
 
     int is_playing;
 } Sequencer;
 
 /* API */
 void sequencer_init(Sequencer *s, int bpm);
+void sequencer_free(Sequencer *s);
+/* copies only p's used rows; p can be discarded afterwards */
 void sequencer_add_pattern(Sequencer *s, Pattern *p);
 void sequencer_set_order(Sequencer *s, int *order, int order_len);
 void sequencer_start(Sequencer *s);
 void sequencer_stop(Sequencer *s);
 
-/* Blocking runner: runs until the order is finished (or stopped) */
+/* Blocking runner: runs until the order is finished (or stopped). Wakes
+   only on ticks where a channel changes, at absolute CLOCK_MONOTONIC
+   deadlines, so it stays locked to tempo however long the song is. */
 void sequencer_run_blocking(Sequencer *s);
 
 /* helper: convert note name to frequency (C-4, C4, D#3, A4, etc.) */
 float note_name_to_freq(const char *name);
 
+/* helpers: note name to MIDI note number (-1 if invalid), MIDI number to Hz.
+   midi_to_freq is a table lookup for 0 .. MIDI_FREQ_TABLE_SIZE-1. */
+#define MIDI_FREQ_TABLE_SIZE 256
+int note_name_to_midi(const char *name);
+float midi_to_freq(int midi);
+
 /* helpers for building dummy patterns in user code */
 Pattern make_empty_pattern(int id);
 NoteEvent make_note(const char *note_name, const char *len_token, Instrument inst);
@@ -0,0 +1,198 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include "osc.h"
+
+#define SYNTH_SAMPLE_RATE 44100
+#define SYNTH_CHANNELS 32      /* song channels the synth can address */
+#define SYNTH_CHORD_SLOTS 8    /* notes one channel can hold at once */
+#define SYNTH_MAX_VOICES 256   /* voice pool size */
+#define SYNTH_BLOCK_FRAMES 256 /* voices are rendered this many frames at a time */
+#define SYNTH_MIX_GROUP 8      /* voices rendered before each mix call */
+#define SYNTH_GAIN 0.2f
+#define SYNTH_CONTROL_FRAMES 64 /* envelopes and effects are evaluated once per this many frames */
+#define SYNTH_ARPEGGIO_HZ 50   /* arpeggio steps per second */
+
+typedef enum {
+    INST_SINE = 1,
+    INST_SQUARE,
+    INST_TRIANGLE,
+    INST_SAW,
+    INST_NOISE
+} Instrument;
+
+typedef enum {
+    SYNTH_EV_NOTE_ON,
+    SYNTH_EV_NOTE_OFF,
+    SYNTH_EV_RESTORE     /* replace the whole state with a synth_snapshot() */
+} SynthEventType;
+
+typedef enum {
+    SYNTH_FX_NONE,
+    SYNTH_FX_PORTAMENTO,   /* fx_a: seconds to glide from the slot's previous pitch */
+    SYNTH_FX_VIBRATO,      /* fx_a: rate in Hz, fx_b: depth in semitones */
+    SYNTH_FX_ARPEGGIO      /* fx_a, fx_b: semitones above the note, cycled with it */
+} SynthEffect;
+
+/* How a note sounds besides its pitch and waveform. Times are seconds,
+   levels 0..1. A zero attack starts the note at full level and a zero
+   release cuts it dead, so SYNTH_NOTE_PLAIN is a plain on/off note. */
+typedef struct {
+    float volume;
+    float attack, decay, sustain, release;
+    SynthEffect effect;
+    float fx_a, fx_b;
+} SynthNote;
+
+#define SYNTH_NOTE_PLAIN { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, SYNTH_FX_NONE, 0.0f, 0.0f }
+
+/* A note change stamped with the absolute output frame it applies at.
+   Notes are addressed by (channel, slot): a chord puts its notes in slots
+   0, 1, 2... of one channel. NOTE_OFF with slot < 0 stops the whole channel. */
+typedef struct {
+    uint64_t frame;
+    SynthEventType type;
+    int channel;
+    int slot;
+    float frequency;
+    Instrument instrument;
+    uint32_t seed;       /* NOTE_ON: noise generator seed, see synth_noise_seed() */
+    SynthNote note;      /* NOTE_ON: envelope, volume and effect */
+    const void *state;   /* RESTORE: snapshot, kept alive by the sender until applied */
+} SynthEvent;
+
+/* Mixer state: shared by the SDL callback and the offline renderer.
+   Holds no device resources, so any number of instances can run at once.
+
+   Voices come from a fixed pool, kept as a structure of arrays. Sounding
+   voices are listed densely in active[], so rendering and mixing cost
+   follows the number of notes playing, not the pool size. The list is
+   kept in (channel, slot, start) order: the mix order, and with it every
+   output sample, depends only on the events applied.
+
+   Envelopes, volume and effects are control-rate: each voice evaluates
+   them once per SYNTH_CONTROL_FRAMES of its own lifetime, and the gain in
+   between is a linear ramp applied to the whole block. Pitch holds for a
+   control block. Control blocks start at the voice's last event, so how
+   the output is split into render calls never changes a sample. A note
+   whose release is running has left its slot; it keeps sounding as a
+   tail and is dropped from the list once the release is over. */
+typedef struct {
+    int sample_rate;
+    int polyphony;                         /* voices usable, <= SYNTH_MAX_VOICES */
+
+    /* voice pool; every per-voice array is listed in voice_fields
+       (synth.c) so snapshots carry it */
+    uint32_t phase[SYNTH_MAX_VOICES];      /* fixed-point cycle fraction, see osc.h */
+    uint32_t phase_inc[SYNTH_MAX_VOICES];
+    float frequency[SYNTH_MAX_VOICES];
+    Instrument instrument[SYNTH_MAX_VOICES];
+    OscNoise noise[SYNTH_MAX_VOICES];
+    uint64_t started[SYNTH_MAX_VOICES];    /* note-on sequence number */
+    uint8_t channel[SYNTH_MAX_VOICES];
+    uint8_t slot[SYNTH_MAX_VOICES];
+
+    /* control state: the current control block runs from ctl_pos to
+       SYNTH_CONTROL_FRAMES with gain going gain_from -> gain_to */
+    uint16_t ctl_pos[SYNTH_MAX_VOICES];
+    uint64_t age[SYNTH_MAX_VOICES];        /* frames from the last event to the block start */
+    uint32_t base_inc[SYNTH_MAX_VOICES];   /* phase_inc of the note itself */
+    float gain_from[SYNTH_MAX_VOICES];
+    float gain_to[SYNTH_MAX_VOICES];
+    float volume[SYNTH_MAX_VOICES];
+    uint8_t env_stage[SYNTH_MAX_VOICES];
+    uint8_t finished[SYNTH_MAX_VOICES];    /* release over, waiting for synth_reap() */
+    float env_from[SYNTH_MAX_VOICES];      /* envelope level at block start */
+    float env_level[SYNTH_MAX_VOICES];     /* ... and at block end */
+    float attack_step[SYNTH_MAX_VOICES];   /* level change per frame */
+    float decay_step[SYNTH_MAX_VOICES];
+    float release_step[SYNTH_MAX_VOICES];
+    float sustain[SYNTH_MAX_VOICES];
+    float release[SYNTH_MAX_VOICES];       /* seconds */
+    uint8_t effect[SYNTH_MAX_VOICES];      /* SynthEffect */
+    float fx_a[SYNTH_MAX_VOICES];
+    float fx_b[SYNTH_MAX_VOICES];
+    float glide[SYNTH_MAX_VOICES];         /* portamento: semitones from the note at block start */
+    float glide_step[SYNTH_MAX_VOICES];    /* ... and its change per frame */
+
+    uint16_t active[SYNTH_MAX_VOICES];     /* sounding voices, in mix order */
+    int active_count;
+    uint16_t free_voices[SYNTH_MAX_VOICES];
+    int free_count;
+    int16_t slot_voice[SYNTH_CHANNELS][SYNTH_CHORD_SLOTS]; /* voice in each slot, -1 if none */
+
+    uint64_t note_seq;
+    uint64_t stolen;                       /* voices taken over by the stealing policy */
+    uint32_t muted;                        /* channels left out of the mix (bit c); they keep running */
+
+    float block[SYNTH_MIX_GROUP][SYNTH_BLOCK_FRAMES];
+} Synth;
+
+void synth_init(Synth *s, int sample_rate);
+
+/* Limit the pool to 'voices' (1..SYNTH_MAX_VOICES); only call while no
+   voice is sounding, e.g. right after synth_init() */
+void synth_set_polyphony(Synth *s, int voices);
+
+/* Start a note in slot 'slot' of channel 'id'; note may be NULL for a
+   plain note. A note already in that slot is retuned in place, keeping its
+   phase (and noise stream when both are noise): a new pitch or instrument
+   restarts the envelope from the level it has reached, unless the note
+   glides there with portamento; the same pitch only takes the new volume
+   and effect. Otherwise a free voice starts at phase 0; if the pool is
+   exhausted the oldest released note, else the oldest note, is stolen. */
+void synth_note_on(Synth *s, int id, int slot, float freq, Instrument inst, uint32_t seed, const SynthNote *note);
+/* Release the note in the slot: with a release time it fades out as a tail
+   and the slot is free at once */
+void synth_note_off(Synth *s, int id, int slot);
+
+/* Slot 0 helpers, for one note per channel */
+void synth_set_channel(Synth *s, int id, float freq, Instrument inst);
+void synth_set_channel_seeded(Synth *s, int id, float freq, Instrument inst, uint32_t seed);
+/* Stop every note on the channel */
+void synth_stop_channel(Synth *s, int id);
+void synth_apply_event(Synth *s, const SynthEvent *ev);
+
+/* Noise seed for notes in (channel, slot). A noise note-on restarts the
+   voice's generator from its seed unless the voice is already playing
+   noise, so renders are bit-identical between runs. */
+uint32_t synth_noise_seed(uint32_t song_seed, int channel, int slot);
+
+/* Mix all sounding voices into out[0..frames) (mono float, overwrites out).
+   Voices on muted channels advance as if rendered but are not heard. */
+void synth_render(Synth *s, float *out, int frames);
+
+/* Advance every sounding voice by 'frames' without rendering: phase and
+   noise position end up exactly where synth_render() would leave them. */
+void synth_skip(Synth *s, uint64_t frames);
+
+/* Split rendering for several threads: render active voice 'index' (its
+   position in s->active) into out[0..frames) without mixing. Voices share
+   no state, so different indexes may be rendered concurrently. Rendering
+   synth_span() frames at a time, mixing the rows in active order with
+   mix_sum() and SYNTH_GAIN, then calling synth_reap() reproduces
+   synth_render() exactly. */
+void synth_render_voice(Synth *s, int index, float *out, int frames);
+
+/* frames (at most 'frames') that can be rendered before a released note
+   ends; synth_render() never renders past that point in one go */
+int synth_span(const Synth *s, int frames);
+
+/* Drop the notes whose release has ended */
+void synth_reap(Synth *s);
+
+/* Snapshots: the sounding voices and the note counters, compact enough to
+   keep one per pattern boundary. Restoring one into a synth at the same
+   sample rate continues exactly as the synth it was taken from would;
+   voices may land in different pool entries, which changes nothing audible. */
+size_t synth_snapshot_size(const Synth *s);
+void synth_snapshot(const Synth *s, void *buf);   /* writes synth_snapshot_size() bytes */
+void synth_restore(Synth *s, const void *snapshot);
+
+/* Renumber the sounding notes 1..n in note-on order. Only their order is
+   ever used, so nothing audible changes, but two synths in the same state
+   then take byte-identical snapshots whatever came before. */
+void synth_renumber(Synth *s);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TEMPO_H
+#define TEMPO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dawn_format.h"
+
+/* A song's tempo over time, compiled for one sample rate. The map is cut
+   into segments at tempo changes (and where ramps end); each one holds a
+   tempo, or ramps linearly in ticks from one tempo to another, and
+   carries the frame it starts at: the prefix sum of the segments before
+   it. Converting between ticks and frames is a binary search for the
+   segment plus closed-form arithmetic inside it, so the cost depends on
+   the number of changes only logarithmically and never on where in the
+   song the position is. */
+typedef struct {
+    uint64_t tick;          /* song tick the segment starts at */
+    uint64_t frame;         /* ... and the frame that tick falls on */
+    double from, to;        /* BPM at the ramp's start and end; equal for a held tempo */
+    uint64_t ramp_ticks;    /* ramp length, 0 for a held tempo; a following
+                               change may cut the segment short of it */
+} TempoSegment;
+
+typedef struct {
+    int sample_rate;
+    int ticks_per_beat;
+    int count;
+    TempoSegment *segments; /* by tick; segments[0] starts at tick 0, frame 0 */
+} TempoMap;
+
+/* Build the map of 'song' from its TEMPO and its tempo changes; order_ticks
+   gives the tick each ORDER entry starts at. False (with a message) on
+   allocation failure. */
+bool tempo_map_build(TempoMap *m, const DawnSong *song, const uint64_t *order_ticks, int sample_rate);
+void tempo_map_free(TempoMap *m);
+
+/* The frame song tick 'tick' starts at. Exact within a held tempo: the
+   first segment maps ticks as a song without tempo changes always has. */
+uint64_t tempo_frame(const TempoMap *m, uint64_t tick);
+
+/* The song tick (with its fraction) playing at 'frame' */
+double tempo_tick(const TempoMap *m, uint64_t frame);
+
+/* How long tick 'tick' lasts in seconds, at the tempo it starts at */
+double tempo_tick_seconds(const TempoMap *m, uint64_t tick);
+
+#endif
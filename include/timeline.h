@@ -0,0 +1,59 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dawn_format.h"
+#include "synth.h"
+#include "tempo.h"
+
+/* One note change at an exact frame offset from the song start, for
+   chord slot 'slot' of a channel. frequency == 0 means the slot stops. */
+typedef struct {
+    uint64_t frame;
+    float frequency;
+    uint8_t channel;
+    uint8_t slot;
+    uint8_t instrument; /* Instrument */
+    uint8_t volume;     /* row volume, 0..DAWN_VOLUME_MAX */
+    uint8_t effect;     /* DawnEffect */
+    uint8_t param;
+    float glide;        /* portamento: param ticks in seconds, at the tempo there */
+} TimelineEvent;
+
+/* A song compiled for one sample rate: every ORDER entry unrolled into a
+   single array sorted by frame. Playback and offline render only walk it. */
+typedef struct {
+    int sample_rate;
+    int channel_count;
+    uint32_t seed;          /* song noise seed, see synth_noise_seed() */
+    uint64_t song_frames;   /* where the last ORDER entry ends */
+    uint64_t total_frames;  /* song_frames plus the longest release tail; everything is silent here */
+    int event_count;
+    TimelineEvent *events;
+    int order_count;
+    uint64_t *order_frames; /* frame each ORDER entry starts at */
+    uint64_t *order_ticks;  /* ... and tick */
+    TempoMap tempo;         /* tick <-> frame */
+    DawnVoice voices[DAWN_MAX_CHANNELS];
+} Timeline;
+
+/* Returns false (and prints why) on allocation failure */
+bool timeline_compile(const DawnSong *song, int sample_rate, Timeline *out);
+void timeline_free(Timeline *t);
+
+/* Convert to a synth event, shifted by base_frame (the frame the song starts at) */
+void timeline_synth_event(const Timeline *t, const TimelineEvent *ev, uint64_t base_frame, SynthEvent *out);
+
+/* Index of the first event at or after 'frame' (event_count if none) */
+int timeline_first_event(const Timeline *t, uint64_t frame);
+
+/* What each chord slot is playing going into event 'first': its last
+   event before that, or a stop (frequency 0) if it has none */
+void timeline_slots_before(const Timeline *t, int first, TimelineEvent slots[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD]);
+
+/* True if b, following a in the same slot, changes nothing; the compiler
+   drops such events */
+bool timeline_same_sound(const TimelineEvent *a, const TimelineEvent *b);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+/* Fixed pool of worker threads for fork/join work (offline rendering).
+   The calling thread takes part as worker 0, so a pool of one thread
+   spawns nothing and workers_run() is a plain function call. */
+
+#define WORKERS_MAX 64
+
+typedef struct WorkerPool WorkerPool;
+
+/* fn runs once on every worker, index in [0, count) */
+typedef void (*WorkerFn)(void *arg, int index, int count);
+
+/* threads <= 0 means one per online CPU; NULL if threads can't be started */
+WorkerPool *workers_create(int threads);
+void workers_destroy(WorkerPool *pool);
+
+int workers_count(const WorkerPool *pool);
+
+/* Run fn on all workers and return once every one of them has finished */
+void workers_run(WorkerPool *pool, WorkerFn fn, void *arg);
+
+/* online CPUs, at least 1 */
+int workers_cpu_count(void);
+
+#endif
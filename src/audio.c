@@ -1,105 +1,247 @@
-#define _USE_MATH_DEFINES
-#include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 #include "audio.h"
+#include "event_queue.h"
+
+/* synth is owned by the audio thread; the control thread only talks to it through queue */
+static Synth synth;
+static EventQueue queue;
+static SDL_AudioDeviceID device;
+static AudioConfig config;    /* what the device gave us */
+static float *mono;           /* mono mix for multi-channel devices, config.buffer_frames long */
+static _Atomic uint64_t frames_played; /* frame time of the next block the callback will render */
+static _Atomic uint32_t muted;         /* audio_set_muted(), copied into the synth per callback */
+
+/* Callback statistics. The audio thread is the only writer and publishes
+   through a sequence counter (odd while an update is in progress), so it
+   never waits and readers retry until they get a consistent copy. */
+static _Atomic uint32_t stats_seq;
+static struct {
+    _Atomic uint64_t callbacks, frames, budget_ns, total_ns, worst_ns, worst_budget_ns;
+    _Atomic uint64_t underruns, late_events, worst_late_frames;
+    _Atomic uint64_t load_histogram[AUDIO_STATS_BUCKETS];
+} stats;
+static uint64_t perf_frequency;
+
+#define STAT_GET(field) atomic_load_explicit(&stats.field, memory_order_relaxed)
+#define STAT_SET(field, v) atomic_store_explicit(&stats.field, (v), memory_order_relaxed)
+
+static uint64_t ticks_to_ns(uint64_t ticks) {
+    return ticks / perf_frequency * 1000000000ull + ticks % perf_frequency * 1000000000ull / perf_frequency;
+}
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-#define SAMPLE_RATE 44100
-#define CHANNEL_COUNT 8
-
-static Channel channels[CHANNEL_COUNT];
-
-static float generate_sample(Channel *ch) {
-    if (!ch->active) return 0.0f;
+/* audio thread only */
+static void stats_record(int frames, uint64_t elapsed_ns, uint64_t late, uint64_t worst_late) {
+    uint64_t budget_ns = (uint64_t)frames * 1000000000ull / (uint64_t)config.sample_rate;
+    uint64_t bucket = budget_ns ? elapsed_ns * (AUDIO_STATS_BUCKETS - 1) / budget_ns : AUDIO_STATS_BUCKETS - 1;
+    if (bucket > AUDIO_STATS_BUCKETS - 1) bucket = AUDIO_STATS_BUCKETS - 1;
+
+    uint32_t seq = atomic_load_explicit(&stats_seq, memory_order_relaxed);
+    atomic_store_explicit(&stats_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    STAT_SET(callbacks, STAT_GET(callbacks) + 1);
+    STAT_SET(frames, STAT_GET(frames) + (uint64_t)frames);
+    STAT_SET(budget_ns, budget_ns);
+    STAT_SET(total_ns, STAT_GET(total_ns) + elapsed_ns);
+    if (elapsed_ns > STAT_GET(worst_ns)) {
+        STAT_SET(worst_ns, elapsed_ns);
+        STAT_SET(worst_budget_ns, budget_ns);
+    }
+    if (elapsed_ns > budget_ns) STAT_SET(underruns, STAT_GET(underruns) + 1);
+    if (late) {
+        STAT_SET(late_events, STAT_GET(late_events) + late);
+        if (worst_late > STAT_GET(worst_late_frames)) STAT_SET(worst_late_frames, worst_late);
+    }
+    STAT_SET(load_histogram[bucket], STAT_GET(load_histogram[bucket]) + 1);
 
-    float s = 0.0f;
-    float t = ch->phase;
+    atomic_store_explicit(&stats_seq, seq + 2, memory_order_release);
+}
 
-    switch (ch->instrument) {
-        case INST_SINE:
-            s = sinf(2.0f * M_PI * t);
-            break;
+/* Render n mono frames starting at frame 'start': render up to each
+   event's offset, then apply it; events already in the past are applied
+   at the top (frame 0 means "now", so those are not counted as late) */
+static void render_span(float *out, uint64_t start, int n, uint64_t *late, uint64_t *worst_late) {
+    uint64_t end = start + (uint64_t)n;
+    int pos = 0;
+    const SynthEvent *ev;
+    while ((ev = event_queue_peek(&queue)) && ev->frame < end) {
+        int offset = ev->frame > start ? (int)(ev->frame - start) : 0;
+        if (ev->frame < start && ev->frame != 0) {
+            (*late)++;
+            if (start - ev->frame > *worst_late) *worst_late = start - ev->frame;
+        }
+        if (offset > pos) {
+            synth_render(&synth, out + pos, offset - pos);
+            pos = offset;
+        }
+        synth_apply_event(&synth, ev);
+        event_queue_pop(&queue);
+    }
+    synth_render(&synth, out + pos, n - pos);
+}
 
-        case INST_SQUARE:
-            s = (fmodf(t, 1.0f) < 0.5f) ? 1.0f : -1.0f;
-            break;
+static void audio_callback(void *userdata, Uint8 *stream, int len) {
+    (void)userdata;
+    uint64_t t0 = SDL_GetPerformanceCounter();
+    float *buffer = (float*)stream;
+    int channels = config.channels;
+    int frames = len / (int)(sizeof(float) * (size_t)channels);
+    uint64_t late = 0, worst_late = 0;
+
+    uint64_t start = atomic_load_explicit(&frames_played, memory_order_relaxed);
+    synth.muted = atomic_load_explicit(&muted, memory_order_relaxed);
+
+    if (channels == 1) {
+        render_span(buffer, start, frames, &late, &worst_late);
+    } else {
+        /* render mono, then copy it to every interleaved channel */
+        for (int done = 0; done < frames;) {
+            int n = frames - done < config.buffer_frames ? frames - done : config.buffer_frames;
+            render_span(mono, start + (uint64_t)done, n, &late, &worst_late);
+            float *dst = buffer + (size_t)done * (size_t)channels;
+            for (int i = 0; i < n; i++)
+                for (int c = 0; c < channels; c++) dst[i * channels + c] = mono[i];
+            done += n;
+        }
+    }
 
-        case INST_TRIANGLE:
-            s = fabsf(fmodf(t * 2.0f, 2.0f) - 1.0f) * 2.0f - 1.0f;
-            break;
+    stats_record(frames, ticks_to_ns(SDL_GetPerformanceCounter() - t0), late, worst_late);
+    atomic_store_explicit(&frames_played, start + (uint64_t)frames, memory_order_release);
+}
 
-        case INST_SAW:
-            s = fmodf(t, 1.0f) * 2.0f - 1.0f;
-            break;
+bool audio_init(const AudioConfig *want, AudioConfig *have) {
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        fprintf(stderr, "dawn: SDL init failed: %s\n", SDL_GetError());
+        return false;
+    }
 
-        case INST_NOISE:
-            s = ((float)rand() / RAND_MAX) * 2.0f - 1.0f;
-            break;
+    SDL_AudioSpec desired, obtained;
+    SDL_zero(desired);
+    desired.freq = want && want->sample_rate > 0 ? want->sample_rate : AUDIO_DEFAULT_SAMPLE_RATE;
+    desired.format = AUDIO_F32SYS;
+    desired.channels = (Uint8)(want && want->channels > 0 ? want->channels : AUDIO_DEFAULT_CHANNELS);
+    desired.samples = (Uint16)(want && want->buffer_frames > 0 ? want->buffer_frames : AUDIO_DEFAULT_BUFFER_FRAMES);
+    desired.callback = audio_callback;
+
+    /* the format stays f32; rate, channel count and buffer size are
+       whatever the device prefers, and the engine follows them */
+    device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (device == 0) {
+        fprintf(stderr, "dawn: could not open audio device: %s\n", SDL_GetError());
+        SDL_Quit();
+        return false;
+    }
+    if (obtained.freq < AUDIO_MIN_SAMPLE_RATE || obtained.freq > AUDIO_MAX_SAMPLE_RATE ||
+        obtained.channels < 1 || obtained.channels > AUDIO_MAX_CHANNELS || obtained.samples == 0) {
+        fprintf(stderr, "dawn: unsupported audio device format (%d Hz, %d channels, %d frames)\n",
+            obtained.freq, obtained.channels, obtained.samples);
+        audio_shutdown();
+        return false;
     }
 
-    ch->phase += ch->frequency / SAMPLE_RATE;
-    if (ch->phase >= 1.0f) ch->phase -= 1.0f;
+    config.sample_rate = obtained.freq;
+    config.channels = obtained.channels;
+    config.buffer_frames = obtained.samples;
+    free(mono);
+    mono = config.channels > 1 ? malloc((size_t)config.buffer_frames * sizeof(float)) : NULL;
+    if (config.channels > 1 && !mono) {
+        fprintf(stderr, "dawn: out of memory\n");
+        audio_shutdown();
+        return false;
+    }
 
-    return s * 0.2f;     // volume scaling
+    config.voices = want && want->voices > 0 ? want->voices : SYNTH_MAX_VOICES;
+    synth_init(&synth, config.sample_rate);
+    synth_set_polyphony(&synth, config.voices);
+    event_queue_init(&queue);
+    atomic_store(&frames_played, 0);
+    atomic_store(&muted, 0);
+    memset(&stats, 0, sizeof(stats));
+    perf_frequency = SDL_GetPerformanceFrequency();
+    if (have) *have = config;
+
+    SDL_PauseAudioDevice(device, 0);
+    return true;
 }
 
-static void audio_callback(void *userdata, Uint8 *stream, int len) {
-    (void)userdata;
-    float *buffer = (float*)stream;
-    int samples = len / sizeof(float);
-
-    for (int i = 0; i < samples; i++) {
-        float mix = 0.0f;
-        for (int c = 0; c < CHANNEL_COUNT; c++)
-            mix += generate_sample(&channels[c]);
+const AudioConfig *audio_config(void) {
+    return &config;
+}
 
-        buffer[i] = mix;  // mixed audio
-    }
+bool audio_schedule(const SynthEvent *ev) {
+    return event_queue_push(&queue, ev);
 }
 
-void audio_init(void) {
-    SDL_Init(SDL_INIT_AUDIO);
+void audio_flush(void) {
+    event_queue_flush(&queue);
+}
 
-    SDL_AudioSpec want;
-    SDL_zero(want);
+void audio_set_muted(uint32_t mask) {
+    atomic_store_explicit(&muted, mask, memory_order_relaxed);
+}
 
-    want.freq = SAMPLE_RATE;
-    want.format = AUDIO_F32SYS;
-    want.channels = 1;
-    want.samples = 4096;
-    want.callback = audio_callback;
+uint64_t audio_frames_played(void) {
+    return atomic_load_explicit(&frames_played, memory_order_acquire);
+}
 
-    if (SDL_OpenAudio(&want, NULL) < 0) {
-        fprintf(stderr, "SDL audio failed: %s\n", SDL_GetError());
-        exit(1);
-    }
+void audio_get_stats(AudioStats *out) {
+    uint32_t before, after;
+    do {
+        before = atomic_load_explicit(&stats_seq, memory_order_acquire);
+        out->callbacks = STAT_GET(callbacks);
+        out->frames = STAT_GET(frames);
+        out->budget_ns = STAT_GET(budget_ns);
+        out->total_ns = STAT_GET(total_ns);
+        out->worst_ns = STAT_GET(worst_ns);
+        out->worst_budget_ns = STAT_GET(worst_budget_ns);
+        out->underruns = STAT_GET(underruns);
+        out->late_events = STAT_GET(late_events);
+        out->worst_late_frames = STAT_GET(worst_late_frames);
+        for (int i = 0; i < AUDIO_STATS_BUCKETS; i++) out->load_histogram[i] = STAT_GET(load_histogram[i]);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&stats_seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
 
-    for (int i = 0; i < CHANNEL_COUNT; i++) {
-        channels[i].active = 0;
-        channels[i].phase = 0;
-        channels[i].frequency = 0;
-        channels[i].instrument = INST_SINE;
+void audio_print_stats(FILE *f, const AudioStats *st) {
+    double mean_ms = st->callbacks ? (double)st->total_ns / (double)st->callbacks / 1e6 : 0.0;
+    double budget_ms = (double)st->budget_ns / 1e6;
+    double worst_ms = (double)st->worst_ns / 1e6;
+    fprintf(f, "audio: %llu callbacks, %llu frames, budget %.2f ms\n",
+        (unsigned long long)st->callbacks, (unsigned long long)st->frames, budget_ms);
+    fprintf(f, "audio: mean %.3f ms (%.1f%%), worst %.3f ms (%.1f%%)\n",
+        mean_ms, budget_ms > 0.0 ? mean_ms / budget_ms * 100.0 : 0.0,
+        worst_ms, st->worst_budget_ns ? (double)st->worst_ns / (double)st->worst_budget_ns * 100.0 : 0.0);
+    fprintf(f, "audio: underruns %llu, late events %llu (worst %llu frames)\n",
+        (unsigned long long)st->underruns, (unsigned long long)st->late_events,
+        (unsigned long long)st->worst_late_frames);
+    fprintf(f, "audio: load");
+    for (int i = 0; i < AUDIO_STATS_BUCKETS; i++) {
+        if (i < AUDIO_STATS_BUCKETS - 1) fprintf(f, " %d-%d%%:%llu", i * 10, i * 10 + 10, (unsigned long long)st->load_histogram[i]);
+        else fprintf(f, " >=100%%:%llu", (unsigned long long)st->load_histogram[i]);
     }
-
-    SDL_PauseAudio(0);
+    fprintf(f, "\n");
 }
 
+/* Immediate changes go through the queue too, stamped frame 0 so they
+   apply at the start of the next block (after anything queued before them) */
 void audio_set_channel(int id, float freq, Instrument inst) {
-    if (id < 0 || id >= CHANNEL_COUNT) return;
-    channels[id].frequency = freq;
-    channels[id].instrument = inst;
-    channels[id].active = 1;
+    SynthEvent ev = { 0, SYNTH_EV_NOTE_ON, id, 0, freq, inst, synth_noise_seed(0, id, 0), SYNTH_NOTE_PLAIN, NULL };
+    while (!audio_schedule(&ev)) SDL_Delay(1);
 }
 
 void audio_stop_channel(int id) {
-    if (id < 0 || id >= CHANNEL_COUNT) return;
-    channels[id].active = 0;
+    SynthEvent ev = { 0, SYNTH_EV_NOTE_OFF, id, -1, 0.0f, INST_SINE, 0, SYNTH_NOTE_PLAIN, NULL };
+    while (!audio_schedule(&ev)) SDL_Delay(1);
 }
 
 void audio_shutdown(void) {
-    SDL_CloseAudio();
+    if (device) SDL_CloseAudioDevice(device);
+    device = 0;
     SDL_Quit();
+    free(mono);
+    mono = NULL;
 }
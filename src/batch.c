@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include "batch.h"
+#include "dawnc.h"
+#include "workers.h"
+
+typedef struct {
+    char *path;
+    char *out;             /* the .wav it renders to */
+    bool collides;         /* another song renders to the same file: not rendered */
+    off_t size;            /* scheduling hint: bigger files tend to render longer */
+    bool ok;
+    bool cached;           /* copied from the render cache */
+    uint64_t frames;
+    int sample_rate;
+} BatchSong;
+
+typedef struct {
+    BatchSong *items;
+    int count;
+    int cap;
+} SongList;
+
+/* One per thread. The owner works from the head (its largest songs first),
+   thieves take from the tail, so the two rarely meet. */
+typedef struct {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head, tail;
+} JobQueue;
+
+typedef struct {
+    BatchSong *songs;
+    JobQueue *queues;
+    const BatchOptions *opts;
+} Batch;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/* A missing file is still listed: it fails to load like any bad song */
+static bool add_song(SongList *list, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) st.st_size = 0;
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 64;
+        BatchSong *items = realloc(list->items, sizeof(BatchSong) * (size_t)cap);
+        if (!items) return false;
+        list->items = items;
+        list->cap = cap;
+    }
+    char *copy = malloc(strlen(path) + 1);
+    if (!copy) return false;
+    strcpy(copy, path);
+    BatchSong *song = &list->items[list->count++];
+    memset(song, 0, sizeof(*song));
+    song->path = copy;
+    song->size = st.st_size;
+    return true;
+}
+
+/* name.dawn next to name.dawnc (as --compile leaves them) is one song in
+   two forms, both rendering to name.wav: keep the newer file, the .dawnc
+   if they are as old as each other */
+static bool superseded(const char *path) {
+    size_t n = strlen(path);
+    char *alt = malloc(n + 2);
+    if (!alt) return false;
+    bool compiled = has_suffix(path, ".dawnc");
+    memcpy(alt, path, n + 1);
+    if (compiled) alt[n - 1] = '\0';
+    else strcat(alt, "c");
+    struct stat st, alt_st;
+    bool both = stat(path, &st) == 0 && stat(alt, &alt_st) == 0;
+    free(alt);
+    if (!both) return false;
+    if (alt_st.st_mtim.tv_sec != st.st_mtim.tv_sec) return alt_st.st_mtim.tv_sec > st.st_mtim.tv_sec;
+    if (alt_st.st_mtim.tv_nsec != st.st_mtim.tv_nsec) return alt_st.st_mtim.tv_nsec > st.st_mtim.tv_nsec;
+    return !compiled;
+}
+
+static bool scan_dir(const char *dir, SongList *list) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "dawn: batch: could not open directory %s\n", dir);
+        return false;
+    }
+    bool ok = true;
+    struct dirent *de;
+    while (ok && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        if (!has_suffix(de->d_name, ".dawn") && !has_suffix(de->d_name, ".dawnc")) continue;
+        char *path = malloc(strlen(dir) + strlen(de->d_name) + 2);
+        if (!path) { ok = false; break; }
+        sprintf(path, "%s/%s", dir, de->d_name);
+        if (!superseded(path)) ok = add_song(list, path);
+        free(path);
+    }
+    closedir(d);
+    return ok;
+}
+
+/* One path per line; blank lines and lines starting with '#' are skipped */
+static bool read_list(const char *file, SongList *list) {
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "dawn: batch: could not open %s\n", file);
+        return false;
+    }
+    bool ok = true;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while (ok && (len = getline(&line, &cap, fp)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = '\0';
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '#') continue;
+        ok = add_song(list, p);
+    }
+    free(line);
+    fclose(fp);
+    return ok;
+}
+
+/* largest first, then by name so runs are repeatable */
+static int cmp_songs(const void *a, const void *b) {
+    const BatchSong *x = a, *y = b;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+/* out_dir/<file name without .dawn/.dawnc>.wav */
+static char *output_path(const char *out_dir, const char *song_path) {
+    const char *name = strrchr(song_path, '/');
+    name = name ? name + 1 : song_path;
+    size_t len = strlen(name);
+    if (has_suffix(name, ".dawnc")) len -= 6;
+    else if (has_suffix(name, ".dawn")) len -= 5;
+    char *path = malloc(strlen(out_dir) + len + sizeof("/.wav"));
+    if (path) sprintf(path, "%s/%.*s.wav", out_dir, (int)len, name);
+    return path;
+}
+
+static int cmp_outputs(const void *a, const void *b) {
+    const BatchSong *x = *(BatchSong *const *)a, *y = *(BatchSong *const *)b;
+    int c = strcmp(x->out, y->out);
+    return c ? c : strcmp(x->path, y->path);
+}
+
+/* Work out every song's output file, and fail all but the first (by path)
+   of songs that would write the same one: two workers writing one file at
+   once would leave a mix of both renders */
+static bool assign_outputs(SongList *list, const char *out_dir) {
+    BatchSong **by_out = malloc(sizeof(BatchSong *) * (size_t)(list->count > 0 ? list->count : 1));
+    if (!by_out) {
+        fprintf(stderr, "dawn: out of memory\n");
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i < list->count && ok; i++) {
+        by_out[i] = &list->items[i];
+        ok = (list->items[i].out = output_path(out_dir, list->items[i].path)) != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "dawn: out of memory\n");
+        free(by_out);
+        return false;
+    }
+    qsort(by_out, (size_t)list->count, sizeof(BatchSong *), cmp_outputs);
+    for (int i = 1, first = 0; i < list->count; i++) {
+        if (strcmp(by_out[i]->out, by_out[first]->out) != 0) {
+            first = i;
+            continue;
+        }
+        by_out[i]->collides = true;
+        fprintf(stderr, "dawn: batch: %s would overwrite %s from %s, skipped\n", by_out[i]->path,
+            by_out[i]->out, by_out[first]->path);
+    }
+    free(by_out);
+    return true;
+}
+
+static void render_one(const Batch *b, BatchSong *job) {
+    if (job->collides) return;
+    DawnSong song;
+    if (!dawn_load_song(job->path, &song)) {
+        fprintf(stderr, "dawn: batch: could not load %s\n", job->path);
+        return;
+    }
+    /* the batch is the parallelism: one thread per song */
+    RenderOptions opts = b->opts->render;
+    opts.threads = 1;
+    opts.segments = false;
+
+    RenderStats stats;
+    job->ok = dawn_render_file(&song, job->out, &opts, &stats);
+    if (job->ok) {
+        job->frames = stats.frames;
+        job->sample_rate = stats.sample_rate;
+        job->cached = stats.from_disk_cache;
+    } else {
+        fprintf(stderr, "dawn: batch: could not render %s\n", job->path);
+    }
+    dawn_song_free(&song);
+}
+
+static bool take_job(Batch *b, int self, int count, int *job) {
+    JobQueue *q = &b->queues[self];
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *job = q->jobs[q->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for (int k = 1; !found && k < count; k++) {
+        JobQueue *victim = &b->queues[(self + k) % count];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            *job = victim->jobs[--victim->tail];
+            found = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return found;
+}
+
+static void batch_job(void *arg, int index, int count) {
+    Batch *b = arg;
+    int job;
+    while (take_job(b, index, count, &job)) render_one(b, &b->songs[job]);
+}
+
+static bool make_out_dir(const char *dir) {
+    struct stat st;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "dawn: batch: could not create %s\n", dir);
+        return false;
+    }
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "dawn: batch: %s is not a directory\n", dir);
+        return false;
+    }
+    return true;
+}
+
+bool batch_render(const char *source, const BatchOptions *opts, BatchStats *stats) {
+    if (!source || !opts || !opts->out_dir) return false;
+    double t0 = now_seconds();
+
+    struct stat st;
+    if (stat(source, &st) != 0) {
+        fprintf(stderr, "dawn: batch: no such file or directory %s\n", source);
+        return false;
+    }
+    SongList list = { NULL, 0, 0 };
+    bool ok = S_ISDIR(st.st_mode) ? scan_dir(source, &list) : read_list(source, &list);
+    if (ok) ok = make_out_dir(opts->out_dir);
+    if (ok && list.count > 0) qsort(list.items, (size_t)list.count, sizeof(BatchSong), cmp_songs);
+    if (ok) ok = assign_outputs(&list, opts->out_dir);
+
+    int jobs = opts->jobs > 0 ? opts->jobs : workers_cpu_count();
+    if (jobs > list.count) jobs = list.count > 0 ? list.count : 1;
+    if (jobs > WORKERS_MAX) jobs = WORKERS_MAX;
+
+    WorkerPool *pool = NULL;
+    JobQueue *queues = NULL;
+    int *slots = NULL;
+    if (ok && list.count > 0) {
+        pool = workers_create(jobs);
+        queues = calloc((size_t)jobs, sizeof(JobQueue));
+        slots = malloc(sizeof(int) * (size_t)list.count);
+        if (!pool || !queues || !slots) {
+            fprintf(stderr, "dawn: batch: could not start %d threads\n", jobs);
+            ok = false;
+        }
+    }
+    if (ok && list.count > 0) {
+        /* deal the sorted songs round-robin: every queue starts with a
+           similar mix of long and short songs */
+        int at = 0;
+        for (int q = 0; q < jobs; q++) {
+            int start = at;
+            for (int i = q; i < list.count; i += jobs) slots[at++] = i;
+            pthread_mutex_init(&queues[q].lock, NULL);
+            queues[q].jobs = &slots[start];
+            queues[q].head = 0;
+            queues[q].tail = at - start;
+        }
+        Batch b = { list.items, queues, opts };
+        workers_run(pool, batch_job, &b);
+        for (int q = 0; q < jobs; q++) pthread_mutex_destroy(&queues[q].lock);
+    }
+
+    if (ok && stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->songs = list.count;
+        stats->jobs = jobs;
+        for (int i = 0; i < list.count; i++) {
+            const BatchSong *s = &list.items[i];
+            if (!s->ok) {
+                stats->failed++;
+                continue;
+            }
+            if (s->cached) stats->cached++;
+            stats->frames += s->frames;
+            stats->audio_seconds += (double)s->frames / (double)s->sample_rate;
+        }
+        stats->elapsed = now_seconds() - t0;
+    }
+
+    workers_destroy(pool);
+    free(queues);
+    free(slots);
+    for (int i = 0; i < list.count; i++) {
+        free(list.items[i].path);
+        free(list.items[i].out);
+    }
+    free(list.items);
+    return ok;
+}
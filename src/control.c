@@ -0,0 +1,376 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "audio.h"
+#include "control.h"
+
+#define CONTROL_QUEUE_MASK (CONTROL_QUEUE_CAPACITY - 1)
+/* How often an idle server looks at the stop flag */
+#define CONTROL_POLL_MS 200
+
+typedef struct {
+    int fd;                 /* -1 if the entry is free */
+    size_t len;
+    bool overlong;          /* discarding the rest of a line that did not fit */
+    char *line;             /* CONTROL_LINE_MAX + 1 */
+} Client;
+
+struct Controller {
+    char *path;
+    int listen_fd;
+    pthread_t thread;
+    atomic_bool quit;
+    Client clients[CONTROL_MAX_CLIENTS];
+
+    /* server thread only */
+    DawnSong song;          /* as last handed to the player */
+    int sample_rate;
+    int voices;
+    uint32_t muted, soloed;
+
+    /* server -> player ring, same scheme as EventQueue */
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    ControlCommand queue[CONTROL_QUEUE_CAPACITY];
+};
+
+static bool queue_push(Controller *c, const ControlCommand *cmd) {
+    size_t tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&c->head, memory_order_acquire);
+    if (tail - head >= CONTROL_QUEUE_CAPACITY) return false;
+    c->queue[tail & CONTROL_QUEUE_MASK] = *cmd;
+    atomic_store_explicit(&c->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool control_pending(Controller *c) {
+    return c && atomic_load_explicit(&c->head, memory_order_relaxed) !=
+                atomic_load_explicit(&c->tail, memory_order_acquire);
+}
+
+bool control_poll(Controller *c, ControlCommand *out) {
+    if (!control_pending(c)) return false;
+    size_t head = atomic_load_explicit(&c->head, memory_order_relaxed);
+    *out = c->queue[head & CONTROL_QUEUE_MASK];
+    atomic_store_explicit(&c->head, head + 1, memory_order_release);
+    return true;
+}
+
+/* a whole-token integer in [min, max] */
+static bool parse_int(const char *s, int min, int max, int *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (!s[0] || *end || errno || v < min || v > max) return false;
+    *out = (int)v;
+    return true;
+}
+
+/* "CHn" -> n-1, checked against the song */
+static bool parse_channel(const Controller *c, const char *s, int *out) {
+    if (strncasecmp(s, "CH", 2) == 0) s += 2;
+    if (!parse_int(s, 1, c->song.channel_count, out)) return false;
+    (*out)--;
+    return true;
+}
+
+static void apply_mutes(const Controller *c) {
+    audio_set_muted(c->soloed ? ~c->soloed | c->muted : c->muted);
+}
+
+/* Compile 'song' and its seek index for the player; NULL if out of memory */
+static ReloadedSong *compile_song(const Controller *c, const DawnSong *song) {
+    ReloadedSong *s = calloc(1, sizeof(ReloadedSong));
+    if (!s || !timeline_compile(song, c->sample_rate, &s->tl)) {
+        free(s);
+        return NULL;
+    }
+    s->has_index = seek_index_build(&s->ix, &s->tl, c->voices);
+    if (!s->has_index) {
+        reloaded_song_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void set_reply(char *reply, size_t size, const char *err) {
+    if (err) snprintf(reply, size, "error: %s\n", err);
+    else snprintf(reply, size, "ok\n");
+}
+
+/* Run one command line; the reply goes to 'reply' */
+static void run_line(Controller *c, char *line, char *reply, size_t reply_size) {
+    const char *err = NULL;
+    ControlCommand cmd;
+    memset(&cmd, 0, sizeof(cmd));
+
+    char *rest = line + strspn(line, " \t");
+    char *verb = rest;
+    rest += strcspn(rest, " \t");
+    if (*rest) *rest++ = '\0';
+    rest += strspn(rest, " \t");
+    /* single-argument commands: the argument, with trailing blanks cut */
+    char *arg = rest;
+    size_t n = strlen(arg);
+    while (n > 0 && (arg[n - 1] == ' ' || arg[n - 1] == '\t')) arg[--n] = '\0';
+    int ch, v, bpm = 0;
+    DawnSong edited;
+    bool has_edit = false;
+
+    if (strcmp(verb, "play") == 0 && !*arg) {
+        cmd.type = CONTROL_PLAY;
+    } else if (strcmp(verb, "stop") == 0 && !*arg) {
+        cmd.type = CONTROL_STOP;
+    } else if (strcmp(verb, "quit") == 0 && !*arg) {
+        cmd.type = CONTROL_QUIT;
+    } else if (strcmp(verb, "seek") == 0) {
+        cmd.type = CONTROL_SEEK_ORDER;
+        if (!parse_int(arg, 0, c->song.order_length - 1, &cmd.order)) err = "no such ORDER entry";
+    } else if (strcmp(verb, "seek-time") == 0) {
+        char *end;
+        cmd.type = CONTROL_SEEK_TIME;
+        cmd.seconds = strtod(arg, &end);
+        if (!*arg || *end || !(cmd.seconds >= 0.0)) err = "seek-time takes seconds >= 0";
+    } else if (strcmp(verb, "tempo") == 0) {
+        /* the same rows and arena, only the tempo differs */
+        cmd.type = CONTROL_SONG;
+        if (!parse_int(arg, 1, 999, &v)) {
+            err = "tempo takes a BPM from 1 to 999";
+        } else {
+            edited = c->song;
+            edited.bpm = v;
+            if (!(cmd.song = compile_song(c, &edited))) err = "out of memory";
+            bpm = v;
+        }
+    } else if (strcmp(verb, "mute") == 0 || strcmp(verb, "unmute") == 0 ||
+               strcmp(verb, "solo") == 0 || strcmp(verb, "unsolo") == 0) {
+        if (!parse_channel(c, arg, &ch)) {
+            err = "no such channel";
+        } else {
+            uint32_t *mask = strstr(verb, "solo") ? &c->soloed : &c->muted;
+            if (strncmp(verb, "un", 2) == 0) *mask &= ~(1u << ch);
+            else *mask |= 1u << ch;
+            apply_mutes(c);
+        }
+        set_reply(reply, reply_size, err);
+        return;
+    } else if (strcmp(verb, "pattern") == 0) {
+        /* pattern ID CHn: ROWS */
+        char *id = rest;
+        rest += strcspn(rest, " \t");
+        if (*rest) *rest++ = '\0';
+        rest += strspn(rest, " \t");
+        char *colon = strchr(rest, ':');
+        DawnNote *rows = NULL;
+        uint32_t row_count = 0;
+        cmd.type = CONTROL_SONG;
+        if (!parse_int(id, 0, DAWN_MAX_PATTERNS - 1, &v) || !dawn_song_pattern(&c->song, v)) {
+            err = "no such pattern";
+        } else if (!colon) {
+            err = "pattern takes ID CHn: ROWS";
+        } else {
+            *colon = '\0';
+            if (!parse_channel(c, rest, &ch)) err = "no such channel";
+            else if (!dawn_parse_rows(colon + 1, c->song.channel_instruments[ch], &rows, &row_count))
+                err = "bad rows";
+            else if (!(has_edit = dawn_song_replace_rows(&c->song, v, ch, rows, row_count, &edited)) ||
+                     !(cmd.song = compile_song(c, &edited)))
+                err = "out of memory";
+        }
+        free(rows);
+    } else {
+        err = "unknown command";
+    }
+
+    if (!err && !queue_push(c, &cmd)) err = "busy, try again";
+    if (err) {
+        reloaded_song_free(cmd.song);
+        if (has_edit) dawn_song_free(&edited);
+    } else if (has_edit) {
+        dawn_song_free(&c->song);
+        c->song = edited;
+    } else if (bpm) {
+        c->song.bpm = bpm;
+    }
+    set_reply(reply, reply_size, err);
+}
+
+static void drop_client(Client *cl) {
+    close(cl->fd);
+    cl->fd = -1;
+    cl->len = 0;
+    cl->overlong = false;
+}
+
+/* Read what the client sent and run its complete lines */
+static void serve_client(Controller *c, Client *cl) {
+    char buf[4096];
+    ssize_t got = read(cl->fd, buf, sizeof(buf));
+    if (got <= 0) {
+        if (got == 0 || (errno != EAGAIN && errno != EINTR)) drop_client(cl);
+        return;
+    }
+    for (ssize_t k = 0; k < got; k++) {
+        char ch = buf[k];
+        if (ch != '\n') {
+            if (cl->len < CONTROL_LINE_MAX) cl->line[cl->len++] = ch;
+            else cl->overlong = true;
+            continue;
+        }
+        char reply[128];
+        if (cl->len > 0 && cl->line[cl->len - 1] == '\r') cl->len--;
+        cl->line[cl->len] = '\0';
+        if (cl->overlong) snprintf(reply, sizeof(reply), "error: line longer than %d bytes\n", CONTROL_LINE_MAX);
+        else if (cl->len == 0) reply[0] = '\0';
+        else run_line(c, cl->line, reply, sizeof(reply));
+        cl->len = 0;
+        cl->overlong = false;
+        /* a client that does not read its replies loses them, it never stalls the server */
+        if (reply[0] && send(cl->fd, reply, strlen(reply), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 && errno == EPIPE) {
+            drop_client(cl);
+            return;
+        }
+    }
+}
+
+static void *serve_main(void *arg) {
+    Controller *c = arg;
+    struct pollfd fds[1 + CONTROL_MAX_CLIENTS];
+
+    while (!atomic_load(&c->quit)) {
+        int n = 0;
+        fds[n++] = (struct pollfd){ c->listen_fd, POLLIN, 0 };
+        for (int k = 0; k < CONTROL_MAX_CLIENTS; k++)
+            if (c->clients[k].fd >= 0) fds[n++] = (struct pollfd){ c->clients[k].fd, POLLIN, 0 };
+        if (poll(fds, (nfds_t)n, CONTROL_POLL_MS) <= 0) continue;
+
+        for (int k = 0, f = 1; k < CONTROL_MAX_CLIENTS; k++) {
+            Client *cl = &c->clients[k];
+            if (cl->fd < 0 || fds[f].fd != cl->fd) continue;
+            if (fds[f++].revents) serve_client(c, cl);
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(c->listen_fd, NULL, NULL);
+            if (fd < 0) continue;
+            int k = 0;
+            while (k < CONTROL_MAX_CLIENTS && c->clients[k].fd >= 0) k++;
+            if (k == CONTROL_MAX_CLIENTS) {
+                static const char full[] = "error: too many clients\n";
+                send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            c->clients[k].fd = fd;
+        }
+    }
+    return NULL;
+}
+
+/* Bind, replacing a socket nobody listens on any more */
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "dawn: control socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "dawn: could not create the control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "dawn: %s exists and is not a socket\n", path);
+            close(fd);
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "dawn: another player is listening on %s\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, CONTROL_MAX_CLIENTS) != 0) {
+        fprintf(stderr, "dawn: could not listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Controller *control_start(const char *socket_path, DawnSong *song, int sample_rate, int voices) {
+    Controller *c = calloc(1, sizeof(Controller));
+    char *path = strdup(socket_path);
+    if (!c || !path) {
+        free(c);
+        free(path);
+        dawn_song_free(song);
+        fprintf(stderr, "dawn: out of memory\n");
+        return NULL;
+    }
+    c->path = path;
+    c->song = *song;
+    c->sample_rate = sample_rate;
+    c->voices = voices;
+    atomic_init(&c->quit, false);
+    atomic_init(&c->head, 0);
+    atomic_init(&c->tail, 0);
+
+    bool ok = true;
+    for (int k = 0; k < CONTROL_MAX_CLIENTS; k++) {
+        c->clients[k].fd = -1;
+        if (!(c->clients[k].line = malloc(CONTROL_LINE_MAX + 1))) ok = false;
+    }
+    if (!ok) fprintf(stderr, "dawn: out of memory\n");
+    c->listen_fd = ok ? listen_on(path) : -1;
+    if (c->listen_fd >= 0 && pthread_create(&c->thread, NULL, serve_main, c) != 0) {
+        fprintf(stderr, "dawn: could not start the control thread\n");
+        close(c->listen_fd);
+        unlink(path);
+        c->listen_fd = -1;
+    }
+    if (c->listen_fd < 0) {
+        for (int k = 0; k < CONTROL_MAX_CLIENTS; k++) free(c->clients[k].line);
+        dawn_song_free(&c->song);
+        free(c->path);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void control_stop(Controller *c) {
+    if (!c) return;
+    atomic_store(&c->quit, true);
+    pthread_join(c->thread, NULL);
+    close(c->listen_fd);
+    unlink(c->path);
+    for (int k = 0; k < CONTROL_MAX_CLIENTS; k++) {
+        if (c->clients[k].fd >= 0) close(c->clients[k].fd);
+        free(c->clients[k].line);
+    }
+    ControlCommand cmd;
+    while (control_poll(c, &cmd)) reloaded_song_free(cmd.song);
+    audio_set_muted(0);
+    dawn_song_free(&c->song);
+    free(c->path);
+    free(c);
+}
@@ -2,346 +2,812 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "dawn_format.h"
 
-/* Helpers */
-static char *trim(char *s) {
-    if (!s) return s;
-    while (*s && isspace((unsigned char)*s)) s++;
-    if (*s == 0) return s;
-    char *end = s + strlen(s) - 1;
-    while (end > s && isspace((unsigned char)*end)) end--;
-    end[1] = '\0';
-    return s;
+/* The parser works directly on the mapped file in one forward pass: no line
+   buffers, no re-reading. Text is addressed as [s, e) ranges, never NUL-terminated. */
+
+typedef struct {
+    const char *filename;
+    int line;          /* 1-based line of the cursor, for messages */
+} ParseCtx;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+/* trim [*s, *e) in place */
+static void trim_range(const char **s, const char **e) {
+    while (*s < *e && is_space(**s)) (*s)++;
+    while (*e > *s && is_space((*e)[-1])) (*e)--;
+}
+
+/* case-insensitive "does [s, e) start with kw" */
+static bool starts_with_ci(const char *s, const char *e, const char *kw) {
+    size_t n = strlen(kw);
+    return (size_t)(e - s) >= n && strncasecmp(s, kw, n) == 0;
+}
+
+static bool equals_ci(const char *s, const char *e, const char *kw) {
+    size_t n = strlen(kw);
+    return (size_t)(e - s) == n && strncasecmp(s, kw, n) == 0;
+}
+
+/* atoi() over a range: optional whitespace and sign, then digits; 0 if none */
+static int range_atoi(const char *s, const char *e) {
+    while (s < e && is_space(*s)) s++;
+    int sign = 1;
+    if (s < e && (*s == '-' || *s == '+')) { if (*s == '-') sign = -1; s++; }
+    long v = 0;
+    while (s < e && *s >= '0' && *s <= '9') {
+        if (v < 100000000L) v = v * 10 + (*s - '0');
+        s++;
+    }
+    return (int)(sign * v);
+}
+
+/* Parse-time state. Rows are appended as they are read; dawn_song_pack()
+   then copies only what the song references into the song's arena. */
+typedef struct {
+    int id;
+    uint32_t first_row[DAWN_MAX_CHANNELS];
+    uint32_t row_count[DAWN_MAX_CHANNELS];
+} PatternBuild;
+
+typedef struct {
+    DawnSong *song;     /* scalar fields are written straight into the result */
+    bool has_seed;
+
+    DawnNote *rows;
+    size_t row_count, row_cap;
+
+    PatternBuild *patterns;
+    size_t pattern_count, pattern_cap;
+
+    int32_t *order;
+    size_t order_length, order_cap;
+
+    DawnTempoChange *tempo;
+    size_t tempo_count, tempo_cap;
+} SongBuilder;
+
+/* make room for one more element of elem_size bytes in *buf */
+static bool grow(void **buf, size_t *cap, size_t count, size_t elem_size) {
+    if (count < *cap) return true;
+    size_t ncap = *cap ? *cap * 2 : 64;
+    void *nb = realloc(*buf, ncap * elem_size);
+    if (!nb) {
+        fprintf(stderr, "dawn: out of memory\n");
+        return false;
+    }
+    *buf = nb;
+    *cap = ncap;
+    return true;
+}
+
+static void builder_free(SongBuilder *b) {
+    free(b->rows);
+    free(b->patterns);
+    free(b->order);
+    free(b->tempo);
 }
 
 /* Parse instrument name */
-static Instrument parse_instrument(const char *name) {
-    if (!name) return INST_SINE;
-    if (strcasecmp(name, "SQUARE") == 0) return INST_SQUARE;
-    if (strcasecmp(name, "SINE") == 0) return INST_SINE;
-    if (strcasecmp(name, "TRIANGLE") == 0 || strcasecmp(name, "TRI") == 0) return INST_TRIANGLE;
-    if (strcasecmp(name, "SAW") == 0) return INST_SAW;
-    if (strcasecmp(name, "NOISE") == 0) return INST_NOISE;
+static Instrument parse_instrument(const char *s, const char *e) {
+    if (equals_ci(s, e, "SQUARE")) return INST_SQUARE;
+    if (equals_ci(s, e, "SINE")) return INST_SINE;
+    if (equals_ci(s, e, "TRIANGLE") || equals_ci(s, e, "TRI")) return INST_TRIANGLE;
+    if (equals_ci(s, e, "SAW")) return INST_SAW;
+    if (equals_ci(s, e, "NOISE")) return INST_NOISE;
     return INST_SINE;
 }
 
-/* Parse a single token into a NoteEvent (uses note_name_to_freq from sequencer.h) */
-static bool token_to_noteevent(const char *tok, NoteEvent *ev, Instrument default_instr) {
-    if (!tok || !ev) return false;
-    if (strcmp(tok, "-") == 0) {
-        ev->frequency = 0.0f;
-        ev->length_ticks = 0; /* will be filled later by caller if needed */
+/* Decode a note token straight to a MIDI number, same rules as
+   note_name_to_midi(): letter, optional '#'/'+', octave from the first digit
+   run (default 4). Returns -1 if invalid. */
+static int token_to_midi(const char *s, const char *e) {
+    int base;
+    switch (*s) {
+        case 'C': base = 0; break;
+        case 'D': base = 2; break;
+        case 'E': base = 4; break;
+        case 'F': base = 5; break;
+        case 'G': base = 7; break;
+        case 'A': base = 9; break;
+        case 'B': base = 11; break;
+        default: return -1;
+    }
+    if (e - s > 1 && (s[1] == '#' || s[1] == '+')) base++;
+
+    const char *d = s + 1;
+    while (d < e && !(*d >= '0' && *d <= '9')) d++;
+    int octave = 4;
+    if (d < e) {
+        octave = 0;
+        while (d < e && *d >= '0' && *d <= '9') {
+            octave = octave * 10 + (*d - '0');
+            if (octave > 99) return -1;
+            d++;
+        }
+    }
+    return (octave + 1) * 12 + base;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Effects after a note's ':' -- an optional vN (volume) and at most one of
+   gN, ~xy, axy -- into ev. False if [s, e) is not exactly that. */
+static bool parse_effects(const char *s, const char *e, DawnNote *ev) {
+    bool has_volume = false;
+    while (s < e) {
+        char c = *s++;
+        if (c == 'v' || c == 'V' || c == 'g' || c == 'G') {
+            int v = 0, digits = 0;
+            for (; s < e && *s >= '0' && *s <= '9' && digits < 3; s++, digits++) v = v * 10 + (*s - '0');
+            if (digits == 0) return false;
+            if (c == 'v' || c == 'V') {
+                if (has_volume || v > DAWN_VOLUME_MAX) return false;
+                has_volume = true;
+                ev->volume = (uint8_t)v;
+            } else {
+                if (ev->effect != DAWN_FX_NONE || v < 1 || v > 255) return false;
+                ev->effect = DAWN_FX_PORTAMENTO;
+                ev->param = (uint8_t)v;
+            }
+        } else if (c == '~' || c == 'a' || c == 'A') {
+            if (ev->effect != DAWN_FX_NONE || e - s < 2) return false;
+            int x = hex_digit(s[0]), y = hex_digit(s[1]);
+            if (x < 0 || y < 0) return false;
+            s += 2;
+            ev->effect = c == '~' ? DAWN_FX_VIBRATO : DAWN_FX_ARPEGGIO;
+            ev->param = (uint8_t)(x << 4 | y);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Parse a single token into a DawnNote: a note, '-' or 'x', then for notes
+   and noise hits optionally ':' and effects (C4:v60~52) */
+static bool token_to_note(const char *s, const char *e, DawnNote *ev, Instrument default_instr) {
+    memset(ev, 0, sizeof(*ev)); /* one tick, no effect */
+    ev->volume = DAWN_VOLUME_MAX;
+    const char *colon = memchr(s, ':', (size_t)(e - s));
+    if (colon) {
+        if (colon == s || colon + 1 == e || (colon - s == 1 && *s == '-')) return false;
+        if (!parse_effects(colon + 1, e, ev)) return false;
+        e = colon;
+    }
+    if (e - s == 1 && *s == '-') {
+        ev->note = DAWN_NOTE_REST;
         ev->instr = default_instr;
         return true;
     }
-    if (strcmp(tok, "x") == 0 || strcmp(tok, "X") == 0) {
-        ev->frequency = 0.0f;   /* noise uses instrument type */
-        ev->length_ticks = 0;
+    if (e - s == 1 && (*s == 'x' || *s == 'X')) {
+        ev->note = DAWN_NOTE_REST;   /* noise uses instrument type */
         ev->instr = INST_NOISE;
         return true;
     }
-    float f = note_name_to_freq(tok);
-    if (f <= 0.0f) return false;
-    ev->frequency = f;
-    ev->length_ticks = 0;
+    int midi = token_to_midi(s, e);
+    if (midi <= DAWN_NOTE_REST || midi > 255) return false;
+    ev->note = (uint8_t)midi;
     ev->instr = default_instr;
     return true;
 }
 
-/* Parse a token list string (space-separated tokens) into channel rows.
-   Supports tokens ending with ',' or ';' to indicate continuation or termination.
-   We pass the default_instr to fill each NoteEvent instr if the token is a note.
-*/
-static bool parse_channel_token_lines(const char *buffer, DawnPatternChannel *chan, Instrument default_instr) {
-    if (!buffer || !chan) return false;
-    chan->row_count = 0;
-
-    /* we'll tokenize by whitespace but keep track of tokens that may include trailing , or ; */
-    const char *p = buffer;
-    char token[64];
-    while (*p) {
-        /* skip whitespace */
-        while (*p && isspace((unsigned char)*p)) p++;
-        if (!*p) break;
-
-        /* read token up to whitespace */
-        int ti = 0;
-        while (*p && !isspace((unsigned char)*p) && ti < (int)sizeof(token)-1) {
-            token[ti++] = *p++;
+/* Parse the rows of one "CHn:" definition, starting right after the ':'.
+   Tokens are whitespace-separated and may continue over following lines;
+   a token ending in ';' ends the channel (the rest of that line is ignored),
+   a trailing ',' is allowed as a visual continuation mark. Lines whose first
+   non-blank character is '#' are comments. ctx->line tracks the cursor.
+   Returns the start of the first line after the channel, or NULL on error. */
+static const char *parse_channel_rows(const char *p, const char *end, ParseCtx *ctx,
+                                      SongBuilder *b, int pat_index, int chnum, Instrument default_instr) {
+    uint32_t first = (uint32_t)b->row_count;
+    uint32_t count = 0;
+    bool line_start = false;
+
+    while (p < end) {
+        char c = *p;
+        if (c == '\n') { ctx->line++; p++; line_start = true; continue; }
+        if (is_space(c)) { p++; continue; }
+        if (c == '#' && line_start) {
+            while (p < end && *p != '\n') p++;
+            continue;
         }
-        token[ti] = '\0';
-        if (ti == 0) continue;
+        line_start = false;
 
-        /* check trailing punctuation */
-        int len = strlen(token);
-        bool cont = false;
-        bool term = false;
-        if (len > 0) {
-            if (token[len-1] == ',') { cont = true; token[len-1] = '\0'; }
-            else if (token[len-1] == ';') { term = true; token[len-1] = '\0'; }
-        }
+        const char *ts = p;
+        while (p < end && !is_space(*p)) p++;
+        const char *te = p;
 
-        NoteEvent ev;
-        if (!token_to_noteevent(token, &ev, default_instr)) {
-            fprintf(stderr, "dawn parser: invalid note token '%s'\n", token);
-            return false;
+        bool term = false;
+        if (te[-1] == ';') { term = true; te--; }
+        else if (te[-1] == ',') te--;
+
+        /* a token is one note, or a chord of notes joined by '/' */
+        for (int part = 0; te > ts; part++) {
+            const char *ps = ts;
+            const char *pe = memchr(ps, '/', (size_t)(te - ps));
+            if (!pe) pe = te;
+            bool in_chord = part > 0 || pe < te;
+            ts = pe < te ? pe + 1 : te;
+
+            /* chords are made of notes (or noise hits), never rests */
+            DawnNote ev;
+            bool valid = pe > ps && token_to_note(ps, pe, &ev, default_instr);
+            if (valid && in_chord && pe - ps == 1 && *ps == '-') valid = false;
+            if (!valid) {
+                fprintf(stderr, "dawn parser: %s:%d: invalid note token '%.*s'\n",
+                    ctx->filename, ctx->line, (int)(pe - ps), ps);
+                return NULL;
+            }
+            if (part >= DAWN_MAX_CHORD) {
+                fprintf(stderr, "dawn parser: %s:%d: chord has more than %d notes\n",
+                    ctx->filename, ctx->line, DAWN_MAX_CHORD);
+                return NULL;
+            }
+            if (part > 0) ev.instr |= DAWN_ROW_CHORD;
+            if (count >= DAWN_MAX_PATTERN_ROWS) {
+                fprintf(stderr, "dawn parser: %s:%d: pattern channel too long\n", ctx->filename, ctx->line);
+                return NULL;
+            }
+            if (!grow((void **)&b->rows, &b->row_cap, b->row_count, sizeof(DawnNote))) return NULL;
+            b->rows[b->row_count++] = ev;
+            count++;
         }
 
-        if (chan->row_count >= DAWN_MAX_PATTERN_ROWS) {
-            fprintf(stderr, "dawn parser: pattern channel too long\n");
-            return false;
+        if (term) {
+            while (p < end && *p != '\n') p++;
+            if (p < end) p++; /* the caller counts the next line itself */
+            break;
         }
-        chan->rows[chan->row_count++] = ev;
-
-        /* if term found, stop parsing (caller already collected lines for this channel) */
-        if (term) break;
-        /* otherwise continue — cont=true means continue to next line; but since caller concatenated lines
-           into buffer until ';', we don't need special handling here. */
     }
 
-    return true;
+    /* a channel defined twice keeps its last definition */
+    PatternBuild *pat = &b->patterns[pat_index];
+    pat->first_row[chnum] = first;
+    pat->row_count[chnum] = count;
+    return p;
 }
 
-/* Read a channel's token lines from the file: after the "CHn:" line the rest of that line may contain tokens.
-   We read subsequent lines until we find a token that ends with ';' for this channel.
-   We accumulate the tokens into a temporary buffer and call parse_channel_token_lines() to fill chan.
-*/
-static bool read_channel_pattern(FILE *fp, char *first_line_after_colon, DawnPatternChannel *chan, Instrument default_instr) {
-    if (!fp || !first_line_after_colon || !chan) return false;
-
-    char accum[8192];
-    accum[0] = '\0';
-
-    /* copy the first bits */
-    strncat(accum, first_line_after_colon, sizeof(accum)-strlen(accum)-1);
-    strncat(accum, "\n", sizeof(accum)-strlen(accum)-1);
-
-    bool found_semicolon = false;
+/* FNV-1a, used to give songs without a SEED line a stable seed of their own */
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) { h ^= (unsigned char)*s; h *= 16777619u; }
+    return h;
+}
 
-    /* If the first line already contains ';' then we're done; otherwise keep reading */
-    for (;;) {
-        /* check if accum contains ';' that is not inside a quote (we don't support quotes in pattern tokens) */
-        if (strchr(accum, ';')) { found_semicolon = true; break; }
+/* The next blank-separated word of [*s, e), advancing *s past it; returns
+   its start, and *s is its end */
+static const char *next_word(const char **s, const char *e) {
+    const char *w = *s;
+    while (w < e && is_space(*w)) w++;
+    const char *we = w;
+    while (we < e && !is_space(*we)) we++;
+    *s = we;
+    return w;
+}
 
-        /* peek next line */
-        long pos = ftell(fp);
-        char line[512];
-        if (!fgets(line, sizeof(line), fp)) break;
-        char *t = trim(line);
-        if (t[0] == '#' || t[0] == 0) continue; /* skip blank/comments */
-        /* append */
-        strncat(accum, t, sizeof(accum)-strlen(accum)-1);
-        strncat(accum, "\n", sizeof(accum)-strlen(accum)-1);
+/* digits only, at most 9 of them */
+static bool range_uint(const char *s, const char *e, uint32_t *out) {
+    if (s == e || e - s > 9) return false;
+    uint32_t v = 0;
+    for (; s < e; s++) {
+        if (*s < '0' || *s > '9') return false;
+        v = v * 10 + (uint32_t)(*s - '0');
     }
+    *out = v;
+    return true;
+}
 
-    /* Now parse accumulated tokens */
-    if (!parse_channel_token_lines(accum, chan, default_instr)) {
-        return false;
+/* TEMPO bpm AT entry[:tick] [RAMP n], from just after "TEMPO" */
+static bool parse_tempo_change(const char *s, const char *e, SongBuilder *b) {
+    DawnTempoChange c = { 0, 0, 0, 0 };
+    const char *w = next_word(&s, e);
+    if (!range_uint(w, s, &c.bpm) || c.bpm == 0) return false;
+    next_word(&s, e); /* AT */
+    w = next_word(&s, e);
+    const char *colon = memchr(w, ':', (size_t)(s - w));
+    if (!range_uint(w, colon ? colon : s, &c.order)) return false;
+    if (colon && !range_uint(colon + 1, s, &c.tick)) return false;
+    w = next_word(&s, e);
+    if (w < s) {
+        if (!equals_ci(w, s, "RAMP")) return false;
+        w = next_word(&s, e);
+        if (!range_uint(w, s, &c.ramp_ticks)) return false;
+        if (next_word(&s, e) < s) return false;
     }
-
+    if (b->tempo_count >= DAWN_MAX_TEMPO_CHANGES) return false;
+    if (!grow((void **)&b->tempo, &b->tempo_cap, b->tempo_count, sizeof(DawnTempoChange))) return false;
+    b->tempo[b->tempo_count++] = c;
     return true;
 }
 
-/* Parse a standard key/value or line that appears outside patterns */
-static bool parse_global_key(char *line, DawnSong *song) {
-    char *p = trim(line);
-    if (!p || *p == '\0' || *p == '#') return true;
+/* Parse a standard key/value line [p, e) that appears outside patterns */
+static bool parse_global_key(const char *p, const char *e, SongBuilder *b) {
+    DawnSong *song = b->song;
 
-    if (strncasecmp(p, "TITLE", 5) == 0) {
-        char *q = strchr(p, '"');
+    if (starts_with_ci(p, e, "TITLE")) {
+        const char *q = memchr(p, '"', (size_t)(e - p));
+        const char *r;
         if (!q) {
             /* allow TITLE without quotes (take rest) */
-            char *rest = p + 5;
-            rest = trim(rest);
-            strncpy(song->title, rest, DAWN_MAX_TITLE_LEN-1);
-            return true;
+            q = p + 5;
+            r = e;
+            trim_range(&q, &r);
+        } else {
+            q++;
+            r = memchr(q, '"', (size_t)(e - q));
+            if (!r) return false;
         }
-        q++;
-        char *r = strchr(q, '"');
-        if (!r) return false;
-        int len = (int)(r - q);
+        size_t len = (size_t)(r - q);
         if (len >= DAWN_MAX_TITLE_LEN) len = DAWN_MAX_TITLE_LEN - 1;
-        strncpy(song->title, q, len);
+        memcpy(song->title, q, len);
         song->title[len] = '\0';
         return true;
     }
 
-    if (strncasecmp(p, "TEMPO", 5) == 0) {
-        int v = atoi(p + 5);
-        if (v > 0) song->bpm = v;
-        return true;
+    if (starts_with_ci(p, e, "TEMPO")) {
+        const char *s = p + 5;
+        next_word(&s, e);
+        const char *at = next_word(&s, e);
+        if (!equals_ci(at, s, "AT")) {
+            int v = range_atoi(p + 5, e);
+            if (v > 0) song->bpm = v;
+            return true;
+        }
+        return parse_tempo_change(p + 5, e, b);
     }
 
-    if (strncasecmp(p, "TPB", 3) == 0) {
-        int v = atoi(p + 3);
+    if (starts_with_ci(p, e, "TPB")) {
+        int v = range_atoi(p + 3, e);
         if (v > 0) song->ticks_per_beat = v;
         return true;
     }
 
-    if (strncasecmp(p, "CHANNELS", 8) == 0) {
-        int v = atoi(p + 8);
+    if (starts_with_ci(p, e, "SEED")) {
+        char num[32];
+        const char *s = p + 4, *t = e;
+        trim_range(&s, &t);
+        size_t n = (size_t)(t - s) < sizeof(num) - 1 ? (size_t)(t - s) : sizeof(num) - 1;
+        memcpy(num, s, n);
+        num[n] = '\0';
+        song->seed = (uint32_t)strtoul(num, NULL, 0);
+        b->has_seed = true;
+        return true;
+    }
+
+    if (starts_with_ci(p, e, "RATE")) {
+        int v = range_atoi(p + 4, e);
+        if (v > 0) song->sample_rate = v;
+        return true;
+    }
+
+    if (starts_with_ci(p, e, "BUFFER")) {
+        int v = range_atoi(p + 6, e);
+        if (v > 0) song->buffer_frames = v;
+        return true;
+    }
+
+    if (starts_with_ci(p, e, "OUTPUT_CHANNELS")) {
+        int v = range_atoi(p + 15, e);
+        if (v > 0) song->output_channels = v;
+        return true;
+    }
+
+    if (starts_with_ci(p, e, "CHANNELS")) {
+        int v = range_atoi(p + 8, e);
         if (v > 0 && v <= DAWN_MAX_CHANNELS) song->channel_count = v;
         return true;
     }
 
-    if (strncasecmp(p, "ORDER", 5) == 0) {
+    if (starts_with_ci(p, e, "ORDER")) {
         /* tokens after ORDER are pattern ids */
-        char *tok = strtok(p + 5, " \t");
-        int idx = 0;
-        while (tok && idx < DAWN_MAX_ORDER) {
-            int id = atoi(tok);
-            song->order[idx++] = id;
-            tok = strtok(NULL, " \t");
+        const char *s = p + 5;
+        b->order_length = 0;
+        while (s < e && b->order_length < DAWN_MAX_ORDER) {
+            while (s < e && (*s == ' ' || *s == '\t')) s++;
+            if (s >= e) break;
+            const char *t = s;
+            while (t < e && *t != ' ' && *t != '\t') t++;
+            if (!grow((void **)&b->order, &b->order_cap, b->order_length, sizeof(int32_t))) return false;
+            b->order[b->order_length++] = range_atoi(s, t);
+            s = t;
         }
-        song->order_length = idx;
         return true;
     }
 
-    if (strncasecmp(p, "CH", 2) == 0) {
-        /* CHn INSTR NAME  -> set instrument for channel n */
-        /* find number after CH */
-        int chnum = atoi(p + 2) - 1;
+    if (starts_with_ci(p, e, "CH")) {
+        /* CHn INSTR NAME | CHn ADSR a d s r | CHn VOLUME v */
+        int chnum = range_atoi(p + 2, e) - 1;
         if (chnum < 0 || chnum >= DAWN_MAX_CHANNELS) return false;
-        char *instr_pos = strstr(p, "INSTR");
-        if (!instr_pos) return false;
-        instr_pos += 5;
-        instr_pos = trim(instr_pos);
-        song->channel_instruments[chnum] = parse_instrument(instr_pos);
-        return true;
+        const char *s = p + 2;
+        while (s < e && !is_space(*s)) s++;
+        while (s < e && is_space(*s)) s++;
+        const char *t = e;
+        DawnVoice *voice = &song->channel_voices[chnum];
+
+        if (starts_with_ci(s, e, "INSTR")) {
+            s += 5;
+            trim_range(&s, &t);
+            song->channel_instruments[chnum] = parse_instrument(s, t);
+            return true;
+        }
+        if (starts_with_ci(s, e, "VOLUME")) {
+            int v = range_atoi(s + 6, e);
+            if (v < 0 || v > DAWN_VOLUME_MAX) return false;
+            voice->volume = (uint8_t)v;
+            return true;
+        }
+        if (starts_with_ci(s, e, "ADSR")) {
+            int v[4], n = 0;
+            for (s += 4; n < 4; n++) {
+                while (s < e && is_space(*s)) s++;
+                if (s >= e || *s < '0' || *s > '9') return false;
+                const char *q = s;
+                while (s < e && !is_space(*s)) s++;
+                v[n] = range_atoi(q, s);
+            }
+            if (v[0] > 65535 || v[1] > 65535 || v[2] > DAWN_VOLUME_MAX || v[3] > 65535) return false;
+            voice->attack_ms = (uint16_t)v[0];
+            voice->decay_ms = (uint16_t)v[1];
+            voice->sustain = (uint8_t)v[2];
+            voice->release_ms = (uint16_t)v[3];
+            return true;
+        }
+        return false;
     }
 
     /* unknown global key — ignore */
     return true;
 }
 
+/* Copy the parsed song into one arena allocation:
+   [patterns][channels][order][tempo changes][pattern_index][rows].
+   Channels beyond channel_count are never played and are dropped here. */
+static bool dawn_song_pack(SongBuilder *b) {
+    DawnSong *song = b->song;
+    size_t cc = (size_t)song->channel_count;
+    size_t np = b->pattern_count;
+
+    int id_limit = 0;
+    size_t nrows = 0;
+    for (size_t p = 0; p < np; p++) {
+        if (b->patterns[p].id + 1 > id_limit) id_limit = b->patterns[p].id + 1;
+        for (size_t c = 0; c < cc; c++) nrows += b->patterns[p].row_count[c];
+    }
+
+    size_t off_channels = np * sizeof(DawnPattern);
+    size_t off_order = off_channels + np * cc * sizeof(DawnChannelData);
+    size_t off_tempo = off_order + b->order_length * sizeof(int32_t);
+    size_t off_index = off_tempo + b->tempo_count * sizeof(DawnTempoChange);
+    size_t off_rows = off_index + (size_t)id_limit * sizeof(int32_t);
+    size_t total = off_rows + nrows * sizeof(DawnNote);
+
+    char *arena = malloc(total ? total : 1);
+    if (!arena) {
+        fprintf(stderr, "dawn: out of memory\n");
+        return false;
+    }
+    song->arena = arena;
+    song->arena_size = total;
+    song->patterns = (DawnPattern *)arena;
+    song->channels = (DawnChannelData *)(arena + off_channels);
+    song->order = (int32_t *)(arena + off_order);
+    song->tempo_changes = (DawnTempoChange *)(arena + off_tempo);
+    song->pattern_index = (int32_t *)(arena + off_index);
+    song->rows = (DawnNote *)(arena + off_rows);
+
+    song->pattern_count = (int)np;
+    song->order_length = (int)b->order_length;
+    song->tempo_change_count = (int)b->tempo_count;
+    song->pattern_id_limit = id_limit;
+    song->row_count = (uint32_t)nrows;
+    if (b->order_length) memcpy(song->order, b->order, b->order_length * sizeof(int32_t));
+    if (b->tempo_count) memcpy(song->tempo_changes, b->tempo, b->tempo_count * sizeof(DawnTempoChange));
+    for (int i = 0; i < id_limit; i++) song->pattern_index[i] = -1;
+
+    uint32_t row = 0;
+    for (size_t p = 0; p < np; p++) {
+        const PatternBuild *pb = &b->patterns[p];
+        song->patterns[p].id = pb->id;
+        song->patterns[p].first_channel = (uint32_t)(p * cc);
+        song->pattern_index[pb->id] = (int32_t)p;
+        for (size_t c = 0; c < cc; c++) {
+            DawnChannelData *cd = &song->channels[p * cc + c];
+            cd->first_row = row;
+            cd->row_count = pb->row_count[c];
+            if (cd->row_count)
+                memcpy(&song->rows[row], &b->rows[pb->first_row[c]], cd->row_count * sizeof(DawnNote));
+            row += cd->row_count;
+        }
+    }
+    return true;
+}
+
 /* Main parser implementation */
 bool dawn_parse_file(const char *filename, DawnSong *out_song) {
     if (!filename || !out_song) return false;
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
         fprintf(stderr, "dawn: could not open %s\n", filename);
+        if (fd >= 0) close(fd);
         return false;
     }
 
+    /* map regular files; anything else (pipes, devices) is read into memory */
+    size_t size = 0;
+    char *data = NULL;
+    bool mapped = false;
+    if (S_ISREG(st.st_mode)) {
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) data = NULL;
+            else mapped = true;
+        }
+    }
+    if (!mapped && (size > 0 || !S_ISREG(st.st_mode))) {
+        size_t cap = 0;
+        size = 0;
+        for (;;) {
+            if (!grow((void **)&data, &cap, size, 1)) { free(data); close(fd); return false; }
+            ssize_t n = read(fd, data + size, cap - size);
+            if (n < 0) {
+                fprintf(stderr, "dawn: could not read %s\n", filename);
+                free(data);
+                close(fd);
+                return false;
+            }
+            if (n == 0) break;
+            size += (size_t)n;
+        }
+    }
+    close(fd);
+#ifdef MADV_SEQUENTIAL
+    if (mapped) madvise(data, size, MADV_SEQUENTIAL);
+#endif
+
     /* initialize defaults */
     memset(out_song, 0, sizeof(DawnSong));
-    strncpy(out_song->title, "", DAWN_MAX_TITLE_LEN);
     out_song->bpm = 120;
     out_song->ticks_per_beat = 4; /* default small TPB, but you can pick larger in file */
     out_song->channel_count = 5;
-    out_song->pattern_count = 0;
-    out_song->order_length = 0;
-
-    for (int i = 0; i < DAWN_MAX_CHANNELS; i++) out_song->channel_instruments[i] = INST_SINE;
-
-    char rawline[512];
-    DawnPattern *current_pattern = NULL;
-    bool in_pattern = false;
-
-    while (fgets(rawline, sizeof(rawline), fp)) {
-        char *line = trim(rawline);
-        if (!line || *line == '\0' || *line == '#') continue;
-
-        if (!in_pattern) {
-            if (strncasecmp(line, "PATTERN", 7) == 0) {
-                /* Begin a pattern */
-                int pid = atoi(line + 7);
-                if (pid < 0 || pid >= DAWN_MAX_PATTERNS) {
-                    fprintf(stderr, "dawn: invalid pattern id %d\n", pid);
-                    fclose(fp);
-                    return false;
-                }
-                current_pattern = &out_song->patterns[out_song->pattern_count++];
-                memset(current_pattern, 0, sizeof(DawnPattern));
-                current_pattern->id = pid;
-                current_pattern->channel_count = out_song->channel_count;
-                for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
-                    current_pattern->channels[c].channel = c;
-                    current_pattern->channels[c].row_count = 0;
-                }
-                in_pattern = true;
-                continue;
-            } else {
-                /* global key/value */
-                if (!parse_global_key(line, out_song)) {
-                    fprintf(stderr, "dawn: malformed global line: %s\n", line);
-                    /* not fatal; continue */
-                }
-                continue;
-            }
-        } else {
-            /* inside a pattern: expect lines starting with CHn: or blank to finish pattern */
-            if (strncasecmp(line, "CH", 2) == 0) {
-                /* CHn: ... */
-                int chnum = atoi(line + 2) - 1;
+
+    for (int i = 0; i < DAWN_MAX_CHANNELS; i++) {
+        out_song->channel_instruments[i] = INST_SINE;
+        out_song->channel_voices[i] = (DawnVoice){ 0, 0, 0, DAWN_VOLUME_MAX, DAWN_VOLUME_MAX };
+    }
+
+    SongBuilder b;
+    memset(&b, 0, sizeof(b));
+    b.song = out_song;
+    uint8_t pattern_seen[DAWN_MAX_PATTERNS] = { 0 };
+
+    ParseCtx ctx = { filename, 0 };
+    const char *p = data, *end = data + size;
+    int current_pattern = -1; /* index into b.patterns while inside a PATTERN block */
+    bool ok = true;
+
+    while (ok && p < end) {
+        const char *ls = p;
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *le = nl ? nl : end;
+        p = nl ? nl + 1 : end;
+        ctx.line++;
+
+        trim_range(&ls, &le);
+        if (ls == le || *ls == '#') continue;
+
+        if (current_pattern >= 0) {
+            /* inside a pattern: CHn: lines add channels, anything else ends the pattern */
+            if (starts_with_ci(ls, le, "CH")) {
+                int chnum = range_atoi(ls + 2, le) - 1;
                 if (chnum < 0 || chnum >= DAWN_MAX_CHANNELS) {
-                    fprintf(stderr, "dawn: invalid channel in pattern: %s\n", line);
-                    fclose(fp);
-                    return false;
+                    fprintf(stderr, "dawn: %s:%d: invalid channel in pattern: %.*s\n",
+                        filename, ctx.line, (int)(le - ls), ls);
+                    ok = false;
+                    break;
                 }
-                char *colon = strchr(line, ':');
+                const char *colon = memchr(ls, ':', (size_t)(le - ls));
                 if (!colon) {
-                    fprintf(stderr, "dawn: malformed channel line (missing ':'): %s\n", line);
-                    fclose(fp);
-                    return false;
-                }
-                colon++;
-                char *after = trim(colon);
-                /* Build a small buffer: the rest of the current line plus subsequent lines until we find a ';' for this channel. */
-                /* We'll read following lines from fp until a semicolon appears in the concatenation. */
-                char buf[8192];
-                buf[0] = '\0';
-                strncat(buf, after, sizeof(buf) - strlen(buf) - 1);
-                strncat(buf, "\n", sizeof(buf) - strlen(buf) - 1);
-
-                /* If this chunk already contains ';', we can parse it. Otherwise read more lines. */
-                while (!strchr(buf, ';')) {
-                    long pos = ftell(fp);
-                    if (!fgets(rawline, sizeof(rawline), fp)) break;
-                    char *ln = trim(rawline);
-                    if (!ln || *ln == '\0' || *ln == '#') continue;
-                    /* If the next line is "CH" or "PATTERN" or global keyword, then the missing ';' is an error.
-                       But we'll allow patterns to be ended by a different syntax: require ';' per channel as specified.
-                    */
-                    /* Append */
-                    strncat(buf, ln, sizeof(buf) - strlen(buf) - 1);
-                    strncat(buf, "\n", sizeof(buf) - strlen(buf) - 1);
+                    fprintf(stderr, "dawn: %s:%d: malformed channel line (missing ':'): %.*s\n",
+                        filename, ctx.line, (int)(le - ls), ls);
+                    ok = false;
+                    break;
                 }
-
-                /* Parse the accumulated buffer tokens into the channel */
-                if (!parse_channel_token_lines(buf, &current_pattern->channels[chnum], out_song->channel_instruments[chnum])) {
-                    fprintf(stderr, "dawn: failed to parse pattern channel %d\n", chnum+1);
-                    fclose(fp);
-                    return false;
+                /* rows may run over several lines; resume after them */
+                int first_line = ctx.line;
+                const char *next = parse_channel_rows(colon + 1, end, &ctx, &b, current_pattern,
+                                                      chnum, out_song->channel_instruments[chnum]);
+                if (!next) {
+                    fprintf(stderr, "dawn: %s:%d: failed to parse pattern channel %d\n", filename, first_line, chnum+1);
+                    ok = false;
+                    break;
                 }
+                p = next;
                 continue;
-            } else {
-                /* Not a CHn: line. Could be end of pattern (blank), or next PATTERN start. We'll treat any non-CH/ non-comment as end-of-pattern,
-                   but also allow encountering a new PATTERN keyword in which case we step back by fseek to let outer loop handle it.
-                */
-                if (strncasecmp(line, "PATTERN", 7) == 0) {
-                    /* Move file pointer back to start of this line so outer loop sees PATTERN */
-                    long cur = ftell(fp);
-                    size_t linelen = strlen(rawline);
-                    if (cur >= (long)linelen) fseek(fp, cur - (long)linelen, SEEK_SET);
-                    in_pattern = false;
-                    current_pattern = NULL;
-                    continue;
-                }
-                /* If it's a global key while inside pattern, treat it as end of pattern and handle global on next iteration */
-                in_pattern = false;
-                current_pattern = NULL;
-                /* re-process this line as global: move file pointer back and let outer loop read it again */
-                long cur = ftell(fp);
-                size_t linelen = strlen(rawline);
-                if (cur >= (long)linelen) fseek(fp, cur - (long)linelen, SEEK_SET);
-                continue;
             }
+            current_pattern = -1;
+        }
+
+        if (starts_with_ci(ls, le, "PATTERN")) {
+            /* Begin a pattern */
+            int pid = range_atoi(ls + 7, le);
+            if (pid < 0 || pid >= DAWN_MAX_PATTERNS) {
+                fprintf(stderr, "dawn: %s:%d: invalid pattern id %d\n", filename, ctx.line, pid);
+                ok = false;
+                break;
+            }
+            if (pattern_seen[pid]) {
+                fprintf(stderr, "dawn: %s:%d: pattern %d defined twice\n", filename, ctx.line, pid);
+                ok = false;
+                break;
+            }
+            pattern_seen[pid] = 1;
+            if (!grow((void **)&b.patterns, &b.pattern_cap, b.pattern_count, sizeof(PatternBuild))) { ok = false; break; }
+            PatternBuild *pb = &b.patterns[b.pattern_count];
+            memset(pb, 0, sizeof(PatternBuild));
+            pb->id = pid;
+            current_pattern = (int)b.pattern_count++;
+            continue;
+        }
+
+        /* global key/value */
+        if (!parse_global_key(ls, le, &b)) {
+            fprintf(stderr, "dawn: %s:%d: malformed global line: %.*s\n", filename, ctx.line, (int)(le - ls), ls);
+            /* not fatal; continue */
+        }
+    }
+
+    if (mapped) munmap(data, size);
+    else free(data);
+
+    if (ok && !b.has_seed) out_song->seed = hash_string(out_song->title);
+    if (ok) ok = dawn_song_pack(&b);
+    builder_free(&b);
+    if (!ok) return false;
+
+    /* resolve ORDER now so playback never meets a missing pattern */
+    for (int i = 0; i < out_song->order_length; i++) {
+        if (!dawn_song_pattern(out_song, out_song->order[i])) {
+            fprintf(stderr, "dawn: ORDER entry %d refers to undefined pattern %d\n", i, out_song->order[i]);
+            dawn_song_free(out_song);
+            return false;
         }
     }
+    for (int i = 0; i < out_song->tempo_change_count; i++) {
+        const DawnTempoChange *c = &out_song->tempo_changes[i];
+        if (c->order >= (uint32_t)out_song->order_length) {
+            fprintf(stderr, "dawn: TEMPO %u AT %u: the song has %d ORDER entries\n", c->bpm, c->order,
+                out_song->order_length);
+            dawn_song_free(out_song);
+            return false;
+        }
+    }
+    return true;
+}
+
+void dawn_song_free(DawnSong *song) {
+    if (!song) return;
+    if (song->arena_mapped) munmap(song->arena, song->arena_size);
+    else free(song->arena);
+    song->arena = NULL;
+    song->arena_mapped = false;
+    song->arena_size = 0;
+    song->patterns = NULL;
+    song->channels = NULL;
+    song->order = NULL;
+    song->tempo_changes = NULL;
+    song->pattern_index = NULL;
+    song->rows = NULL;
+    song->pattern_count = 0;
+    song->order_length = 0;
+    song->tempo_change_count = 0;
+    song->row_count = 0;
+    song->pattern_id_limit = 0;
+}
+
+const DawnPattern *dawn_song_pattern(const DawnSong *song, int id) {
+    if (!song || id < 0 || id >= song->pattern_id_limit) return NULL;
+    int idx = song->pattern_index[id];
+    return idx >= 0 ? &song->patterns[idx] : NULL;
+}
+
+const DawnNote *dawn_pattern_rows(const DawnSong *song, const DawnPattern *pat, int c, uint32_t *row_count) {
+    if (!song || !pat || c < 0 || c >= song->channel_count) {
+        if (row_count) *row_count = 0;
+        return NULL;
+    }
+    const DawnChannelData *cd = &song->channels[pat->first_channel + (uint32_t)c];
+    if (row_count) *row_count = cd->row_count;
+    return &song->rows[cd->first_row];
+}
 
-    fclose(fp);
+bool dawn_parse_rows(const char *text, Instrument default_instr, DawnNote **rows, uint32_t *row_count) {
+    SongBuilder b;
+    memset(&b, 0, sizeof(b));
+    PatternBuild pat;
+    memset(&pat, 0, sizeof(pat));
+    b.patterns = &pat;
+    b.pattern_count = 1;
+
+    ParseCtx ctx = { "rows", 1 };
+    const char *end = text + strlen(text);
+    bool ok = parse_channel_rows(text, end, &ctx, &b, 0, 0, default_instr) != NULL;
+    if (!ok) {
+        free(b.rows);
+        return false;
+    }
+    *rows = b.rows;
+    *row_count = pat.row_count[0];
     return true;
 }
+
+bool dawn_song_replace_rows(const DawnSong *song, int id, int c, const DawnNote *rows, uint32_t row_count,
+                            DawnSong *out) {
+    if (!dawn_song_pattern(song, id) || c < 0 || c >= song->channel_count) return false;
+    size_t cc = (size_t)song->channel_count;
+    size_t np = (size_t)song->pattern_count;
+    SongBuilder b;
+    memset(&b, 0, sizeof(b));
+    b.row_cap = (size_t)song->row_count + row_count;
+    b.pattern_cap = np;
+    b.order_cap = (size_t)song->order_length;
+    b.tempo_cap = (size_t)song->tempo_change_count;
+    b.rows = malloc(b.row_cap ? sizeof(DawnNote) * b.row_cap : 1);
+    b.patterns = malloc(np ? sizeof(PatternBuild) * np : 1);
+    b.order = malloc(b.order_cap ? sizeof(int32_t) * b.order_cap : 1);
+    b.tempo = malloc(b.tempo_cap ? sizeof(DawnTempoChange) * b.tempo_cap : 1);
+    if (!b.rows || !b.patterns || !b.order || !b.tempo) {
+        fprintf(stderr, "dawn: out of memory\n");
+        builder_free(&b);
+        return false;
+    }
+
+    for (size_t p = 0; p < np; p++) {
+        PatternBuild *pb = &b.patterns[p];
+        memset(pb, 0, sizeof(PatternBuild));
+        pb->id = song->patterns[p].id;
+        for (size_t ch = 0; ch < cc; ch++) {
+            uint32_t n;
+            const DawnNote *src = dawn_pattern_rows(song, &song->patterns[p], (int)ch, &n);
+            if (pb->id == id && (int)ch == c) {
+                src = rows;
+                n = row_count;
+            }
+            pb->first_row[ch] = (uint32_t)b.row_count;
+            pb->row_count[ch] = n;
+            if (n) memcpy(&b.rows[b.row_count], src, sizeof(DawnNote) * n);
+            b.row_count += n;
+        }
+    }
+    b.pattern_count = np;
+    if (b.order_cap) memcpy(b.order, song->order, sizeof(int32_t) * b.order_cap);
+    b.order_length = b.order_cap;
+    if (b.tempo_cap) memcpy(b.tempo, song->tempo_changes, sizeof(DawnTempoChange) * b.tempo_cap);
+    b.tempo_count = b.tempo_cap;
+
+    /* same settings, fresh arena */
+    *out = *song;
+    out->arena = NULL;
+    out->arena_mapped = false;
+    b.song = out;
+    bool ok = dawn_song_pack(&b);
+    builder_free(&b);
+    return ok;
+}
@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dawnc.h"
+
+/* header field offsets, see dawnc.h */
+#define HDR_VERSION 4
+#define HDR_CHECKSUM 8
+#define HDR_FILE_SIZE 16
+#define HDR_BPM 24
+#define HDR_TPB 28
+#define HDR_CHANNEL_COUNT 32
+#define HDR_SEED 36
+#define HDR_ORDER_LENGTH 40
+#define HDR_PATTERN_COUNT 44
+#define HDR_PATTERN_ID_LIMIT 48
+#define HDR_ROW_COUNT 52
+#define HDR_OFF_PATTERNS 56
+#define HDR_OFF_CHANNELS 60
+#define HDR_OFF_ORDER 64
+#define HDR_OFF_INDEX 68
+#define HDR_OFF_ROWS 72
+#define HDR_SAMPLE_RATE 76
+#define HDR_OUTPUT_CHANNELS 80
+#define HDR_BUFFER_FRAMES 84
+#define HDR_INSTRUMENTS 88   /* DAWN_MAX_CHANNELS bytes */
+#define HDR_TITLE 120        /* DAWN_MAX_TITLE_LEN bytes */
+#define HDR_VOICES 248       /* DAWN_MAX_CHANNELS records of VOICE_RECORD bytes */
+#define VOICE_RECORD 8       /* u16 attack, decay, release (ms), u8 sustain, volume */
+#define HDR_TEMPO_COUNT 504
+#define HDR_OFF_TEMPO 508
+
+_Static_assert(HDR_INSTRUMENTS + DAWN_MAX_CHANNELS <= HDR_TITLE, "instrument table overlaps the title");
+_Static_assert(HDR_TITLE + DAWN_MAX_TITLE_LEN <= HDR_VOICES, "title overlaps the voice table");
+_Static_assert(HDR_VOICES + DAWN_MAX_CHANNELS * VOICE_RECORD <= HDR_TEMPO_COUNT, "voice table overlaps the tempo fields");
+_Static_assert(HDR_OFF_TEMPO + 4 <= DAWNC_HEADER_SIZE, "header fields overflow the header");
+_Static_assert(sizeof(DawnTempoChange) == 16, "tempo changes are serialized as 16 bytes");
+_Static_assert(sizeof(DawnNote) == 8, "rows are serialized as 8 bytes");
+
+#define CHECKSUM_START 16
+
+typedef struct {
+    uint32_t patterns, channels, order, tempo, index, rows;
+    uint64_t total;
+} SectionLayout;
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+/* FNV-1a 64 over little-endian 64-bit words (bytes for the tail):
+   cheap enough to run on every load */
+static uint64_t checksum(const uint8_t *p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        h ^= get_u64(p + i);
+        h *= 0x100000001b3ull;
+    }
+    for (; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* Sections follow the header in DawnSong arena order; every element is a
+   multiple of 4 bytes, so each section stays naturally aligned. */
+static SectionLayout layout_for(uint64_t pattern_count, uint64_t channel_count, uint64_t order_length,
+                                uint64_t tempo_count, uint64_t id_limit, uint64_t row_count) {
+    SectionLayout l;
+    uint64_t off = DAWNC_HEADER_SIZE;
+    l.patterns = (uint32_t)off;
+    off += pattern_count * sizeof(DawnPattern);
+    l.channels = (uint32_t)off;
+    off += pattern_count * channel_count * sizeof(DawnChannelData);
+    l.order = (uint32_t)off;
+    off += order_length * sizeof(int32_t);
+    l.tempo = (uint32_t)off;
+    off += tempo_count * sizeof(DawnTempoChange);
+    l.index = (uint32_t)off;
+    off += id_limit * sizeof(int32_t);
+    l.rows = (uint32_t)off;
+    off += row_count * sizeof(DawnNote);
+    l.total = off;
+    return l;
+}
+
+void *dawnc_serialize(const DawnSong *song, size_t *size) {
+    if (!song || !size) return NULL;
+    size_t cc = (size_t)song->channel_count;
+    SectionLayout l = layout_for((uint64_t)song->pattern_count, cc, (uint64_t)song->order_length,
+                                 (uint64_t)song->tempo_change_count, (uint64_t)song->pattern_id_limit, song->row_count);
+    if (l.total > UINT32_MAX) {
+        fprintf(stderr, "dawn: song too large to compile\n");
+        return NULL;
+    }
+
+    uint8_t *img = calloc(1, (size_t)l.total);
+    if (!img) {
+        fprintf(stderr, "dawn: out of memory\n");
+        return NULL;
+    }
+
+    memcpy(img, DAWNC_MAGIC, 4);
+    put_u32(img + HDR_VERSION, DAWNC_VERSION);
+    put_u64(img + HDR_FILE_SIZE, l.total);
+    put_u32(img + HDR_BPM, (uint32_t)song->bpm);
+    put_u32(img + HDR_TPB, (uint32_t)song->ticks_per_beat);
+    put_u32(img + HDR_CHANNEL_COUNT, (uint32_t)song->channel_count);
+    put_u32(img + HDR_SEED, song->seed);
+    put_u32(img + HDR_ORDER_LENGTH, (uint32_t)song->order_length);
+    put_u32(img + HDR_PATTERN_COUNT, (uint32_t)song->pattern_count);
+    put_u32(img + HDR_PATTERN_ID_LIMIT, (uint32_t)song->pattern_id_limit);
+    put_u32(img + HDR_ROW_COUNT, song->row_count);
+    put_u32(img + HDR_OFF_PATTERNS, l.patterns);
+    put_u32(img + HDR_OFF_CHANNELS, l.channels);
+    put_u32(img + HDR_OFF_ORDER, l.order);
+    put_u32(img + HDR_OFF_INDEX, l.index);
+    put_u32(img + HDR_OFF_ROWS, l.rows);
+    put_u32(img + HDR_TEMPO_COUNT, (uint32_t)song->tempo_change_count);
+    put_u32(img + HDR_OFF_TEMPO, l.tempo);
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) img[HDR_INSTRUMENTS + c] = (uint8_t)song->channel_instruments[c];
+    put_u32(img + HDR_SAMPLE_RATE, (uint32_t)song->sample_rate);
+    put_u32(img + HDR_OUTPUT_CHANNELS, (uint32_t)song->output_channels);
+    put_u32(img + HDR_BUFFER_FRAMES, (uint32_t)song->buffer_frames);
+    memcpy(img + HDR_TITLE, song->title, DAWN_MAX_TITLE_LEN);
+    img[HDR_TITLE + DAWN_MAX_TITLE_LEN - 1] = '\0';
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
+        const DawnVoice *v = &song->channel_voices[c];
+        uint8_t *d = img + HDR_VOICES + c * VOICE_RECORD;
+        put_u16(d, v->attack_ms);
+        put_u16(d + 2, v->decay_ms);
+        put_u16(d + 4, v->release_ms);
+        d[6] = v->sustain;
+        d[7] = v->volume;
+    }
+
+    for (int p = 0; p < song->pattern_count; p++) {
+        uint8_t *d = img + l.patterns + (size_t)p * sizeof(DawnPattern);
+        put_u32(d, (uint32_t)song->patterns[p].id);
+        put_u32(d + 4, song->patterns[p].first_channel);
+    }
+    for (size_t i = 0; i < (size_t)song->pattern_count * cc; i++) {
+        uint8_t *d = img + l.channels + i * sizeof(DawnChannelData);
+        put_u32(d, song->channels[i].first_row);
+        put_u32(d + 4, song->channels[i].row_count);
+    }
+    for (int i = 0; i < song->order_length; i++)
+        put_u32(img + l.order + (size_t)i * 4, (uint32_t)song->order[i]);
+    for (int i = 0; i < song->tempo_change_count; i++) {
+        uint8_t *d = img + l.tempo + (size_t)i * sizeof(DawnTempoChange);
+        put_u32(d, song->tempo_changes[i].order);
+        put_u32(d + 4, song->tempo_changes[i].tick);
+        put_u32(d + 8, song->tempo_changes[i].ramp_ticks);
+        put_u32(d + 12, song->tempo_changes[i].bpm);
+    }
+    for (int i = 0; i < song->pattern_id_limit; i++)
+        put_u32(img + l.index + (size_t)i * 4, (uint32_t)song->pattern_index[i]);
+    for (uint32_t i = 0; i < song->row_count; i++) {
+        uint8_t *d = img + l.rows + (size_t)i * sizeof(DawnNote);
+        d[0] = song->rows[i].note;
+        d[1] = song->rows[i].instr;
+        put_u16(d + 2, song->rows[i].length_ticks);
+        d[4] = song->rows[i].volume;
+        d[5] = song->rows[i].effect;
+        d[6] = song->rows[i].param;
+    }
+
+    put_u64(img + HDR_CHECKSUM, checksum(img + CHECKSUM_START, (size_t)l.total - CHECKSUM_START));
+    *size = (size_t)l.total;
+    return img;
+}
+
+bool dawnc_write(const DawnSong *song, const char *path) {
+    size_t size;
+    uint8_t *img = dawnc_serialize(song, &size);
+    if (!img) return false;
+
+    size_t tmp_len = strlen(path) + 8;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) {
+        free(img);
+        fprintf(stderr, "dawn: out of memory\n");
+        return false;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(img, 1, size, f) == size;
+    if (f && fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "dawn: could not write %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+    free(img);
+    return ok;
+}
+
+/* Structural checks on a checksummed image: counts within the format's
+   limits, sections exactly where the counts put them, and every index
+   in range. O(patterns + order), never touches the rows themselves. */
+static bool validate(const uint8_t *img, uint64_t size, const char *path) {
+    uint32_t bpm = get_u32(img + HDR_BPM);
+    uint32_t tpb = get_u32(img + HDR_TPB);
+    uint32_t cc = get_u32(img + HDR_CHANNEL_COUNT);
+    uint32_t order_length = get_u32(img + HDR_ORDER_LENGTH);
+    uint32_t np = get_u32(img + HDR_PATTERN_COUNT);
+    uint32_t id_limit = get_u32(img + HDR_PATTERN_ID_LIMIT);
+    uint32_t nrows = get_u32(img + HDR_ROW_COUNT);
+    uint32_t ntempo = get_u32(img + HDR_TEMPO_COUNT);
+
+    if (bpm == 0 || bpm > INT32_MAX || tpb == 0 || tpb > INT32_MAX || cc == 0 || cc > DAWN_MAX_CHANNELS ||
+        get_u32(img + HDR_SAMPLE_RATE) > INT32_MAX || get_u32(img + HDR_OUTPUT_CHANNELS) > INT32_MAX ||
+        get_u32(img + HDR_BUFFER_FRAMES) > INT32_MAX ||
+        np > DAWN_MAX_PATTERNS || id_limit > DAWN_MAX_PATTERNS || order_length > DAWN_MAX_ORDER ||
+        ntempo > DAWN_MAX_TEMPO_CHANGES) {
+        fprintf(stderr, "dawn: %s: song header out of range\n", path);
+        return false;
+    }
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
+        const uint8_t *d = img + HDR_VOICES + c * VOICE_RECORD;
+        if (d[6] > DAWN_VOLUME_MAX || d[7] > DAWN_VOLUME_MAX) {
+            fprintf(stderr, "dawn: %s: channel voice out of range\n", path);
+            return false;
+        }
+    }
+
+    SectionLayout l = layout_for(np, cc, order_length, ntempo, id_limit, nrows);
+    if (l.total != size || get_u32(img + HDR_OFF_PATTERNS) != l.patterns ||
+        get_u32(img + HDR_OFF_CHANNELS) != l.channels || get_u32(img + HDR_OFF_ORDER) != l.order ||
+        get_u32(img + HDR_OFF_TEMPO) != l.tempo ||
+        get_u32(img + HDR_OFF_INDEX) != l.index || get_u32(img + HDR_OFF_ROWS) != l.rows) {
+        fprintf(stderr, "dawn: %s: section table does not match the header\n", path);
+        return false;
+    }
+
+    for (uint32_t p = 0; p < np; p++) {
+        const uint8_t *d = img + l.patterns + (size_t)p * sizeof(DawnPattern);
+        uint32_t id = get_u32(d);
+        if (id >= id_limit || get_u32(d + 4) != p * cc || get_u32(img + l.index + (size_t)id * 4) != p) {
+            fprintf(stderr, "dawn: %s: pattern table is inconsistent\n", path);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < (size_t)np * cc; i++) {
+        const uint8_t *d = img + l.channels + i * sizeof(DawnChannelData);
+        uint64_t first = get_u32(d), count = get_u32(d + 4);
+        if (count > DAWN_MAX_PATTERN_ROWS || first + count > nrows) {
+            fprintf(stderr, "dawn: %s: pattern rows out of range\n", path);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < id_limit; i++) {
+        int32_t idx = (int32_t)get_u32(img + l.index + (size_t)i * 4);
+        if (idx < -1 || idx >= (int32_t)np) {
+            fprintf(stderr, "dawn: %s: pattern index out of range\n", path);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < order_length; i++) {
+        uint32_t id = get_u32(img + l.order + (size_t)i * 4);
+        if (id >= id_limit || (int32_t)get_u32(img + l.index + (size_t)id * 4) < 0) {
+            fprintf(stderr, "dawn: %s: ORDER entry %u refers to undefined pattern\n", path, i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < ntempo; i++) {
+        const uint8_t *d = img + l.tempo + (size_t)i * sizeof(DawnTempoChange);
+        if (get_u32(d) >= order_length || get_u32(d + 12) == 0) {
+            fprintf(stderr, "dawn: %s: tempo change %u out of range\n", path, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Point the song's arrays at the sections of 'arena'. On little-endian
+   hosts that is the mapped image itself; elsewhere a swapped copy. */
+static void attach_sections(DawnSong *song, uint8_t *arena, const uint8_t *img) {
+    song->patterns = (DawnPattern *)(arena + get_u32(img + HDR_OFF_PATTERNS));
+    song->channels = (DawnChannelData *)(arena + get_u32(img + HDR_OFF_CHANNELS));
+    song->order = (int32_t *)(arena + get_u32(img + HDR_OFF_ORDER));
+    song->tempo_changes = (DawnTempoChange *)(arena + get_u32(img + HDR_OFF_TEMPO));
+    song->pattern_index = (int32_t *)(arena + get_u32(img + HDR_OFF_INDEX));
+    song->rows = (DawnNote *)(arena + get_u32(img + HDR_OFF_ROWS));
+}
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+/* decode every section into host byte order */
+static void decode_sections(DawnSong *song, const uint8_t *img) {
+    size_t cc = (size_t)song->channel_count;
+    const uint8_t *s = img + get_u32(img + HDR_OFF_PATTERNS);
+    for (int p = 0; p < song->pattern_count; p++, s += sizeof(DawnPattern)) {
+        song->patterns[p].id = (int32_t)get_u32(s);
+        song->patterns[p].first_channel = get_u32(s + 4);
+    }
+    s = img + get_u32(img + HDR_OFF_CHANNELS);
+    for (size_t i = 0; i < (size_t)song->pattern_count * cc; i++, s += sizeof(DawnChannelData)) {
+        song->channels[i].first_row = get_u32(s);
+        song->channels[i].row_count = get_u32(s + 4);
+    }
+    s = img + get_u32(img + HDR_OFF_ORDER);
+    for (int i = 0; i < song->order_length; i++, s += 4) song->order[i] = (int32_t)get_u32(s);
+    s = img + get_u32(img + HDR_OFF_TEMPO);
+    for (int i = 0; i < song->tempo_change_count; i++, s += sizeof(DawnTempoChange)) {
+        song->tempo_changes[i].order = get_u32(s);
+        song->tempo_changes[i].tick = get_u32(s + 4);
+        song->tempo_changes[i].ramp_ticks = get_u32(s + 8);
+        song->tempo_changes[i].bpm = get_u32(s + 12);
+    }
+    s = img + get_u32(img + HDR_OFF_INDEX);
+    for (int i = 0; i < song->pattern_id_limit; i++, s += 4) song->pattern_index[i] = (int32_t)get_u32(s);
+    s = img + get_u32(img + HDR_OFF_ROWS);
+    for (uint32_t i = 0; i < song->row_count; i++, s += sizeof(DawnNote)) {
+        song->rows[i].note = s[0];
+        song->rows[i].instr = s[1];
+        song->rows[i].length_ticks = get_u16(s + 2);
+        song->rows[i].volume = s[4];
+        song->rows[i].effect = s[5];
+        song->rows[i].param = s[6];
+        song->rows[i].reserved = s[7];
+    }
+}
+#endif
+
+bool dawnc_load(const char *path, DawnSong *out) {
+    if (!path || !out) return false;
+    memset(out, 0, sizeof(*out));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "dawn: could not open %s\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    if (st.st_size < DAWNC_HEADER_SIZE) {
+        fprintf(stderr, "dawn: %s: truncated .dawnc image\n", path);
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    uint8_t *img = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img == MAP_FAILED) {
+        fprintf(stderr, "dawn: could not map %s\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    if (memcmp(img, DAWNC_MAGIC, 4) != 0) {
+        fprintf(stderr, "dawn: %s: not a .dawnc image\n", path);
+        ok = false;
+    } else if (get_u32(img + HDR_VERSION) != DAWNC_VERSION) {
+        fprintf(stderr, "dawn: %s: .dawnc version %u, expected %d; recompile the song\n",
+            path, get_u32(img + HDR_VERSION), DAWNC_VERSION);
+        ok = false;
+    } else if (get_u64(img + HDR_FILE_SIZE) != size) {
+        fprintf(stderr, "dawn: %s: truncated .dawnc image\n", path);
+        ok = false;
+    } else if (get_u64(img + HDR_CHECKSUM) != checksum(img + CHECKSUM_START, size - CHECKSUM_START)) {
+        fprintf(stderr, "dawn: %s: checksum mismatch, image is corrupt\n", path);
+        ok = false;
+    } else {
+        ok = validate(img, size, path);
+    }
+    if (!ok) {
+        munmap(img, size);
+        return false;
+    }
+
+    out->bpm = (int)get_u32(img + HDR_BPM);
+    out->ticks_per_beat = (int)get_u32(img + HDR_TPB);
+    out->channel_count = (int)get_u32(img + HDR_CHANNEL_COUNT);
+    out->seed = get_u32(img + HDR_SEED);
+    out->order_length = (int)get_u32(img + HDR_ORDER_LENGTH);
+    out->tempo_change_count = (int)get_u32(img + HDR_TEMPO_COUNT);
+    out->pattern_count = (int)get_u32(img + HDR_PATTERN_COUNT);
+    out->pattern_id_limit = (int)get_u32(img + HDR_PATTERN_ID_LIMIT);
+    out->row_count = get_u32(img + HDR_ROW_COUNT);
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) out->channel_instruments[c] = (Instrument)img[HDR_INSTRUMENTS + c];
+    out->sample_rate = (int)get_u32(img + HDR_SAMPLE_RATE);
+    out->output_channels = (int)get_u32(img + HDR_OUTPUT_CHANNELS);
+    out->buffer_frames = (int)get_u32(img + HDR_BUFFER_FRAMES);
+    memcpy(out->title, img + HDR_TITLE, DAWN_MAX_TITLE_LEN);
+    out->title[DAWN_MAX_TITLE_LEN - 1] = '\0';
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
+        const uint8_t *d = img + HDR_VOICES + c * VOICE_RECORD;
+        DawnVoice *v = &out->channel_voices[c];
+        v->attack_ms = get_u16(d);
+        v->decay_ms = get_u16(d + 2);
+        v->release_ms = get_u16(d + 4);
+        v->sustain = d[6];
+        v->volume = d[7];
+    }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    out->arena = img;
+    out->arena_size = size;
+    out->arena_mapped = true;
+    attach_sections(out, img, img);
+#else
+    uint8_t *arena = malloc(size);
+    if (!arena) {
+        fprintf(stderr, "dawn: out of memory\n");
+        munmap(img, size);
+        return false;
+    }
+    out->arena = arena;
+    out->arena_size = size;
+    attach_sections(out, arena, img);
+    decode_sections(out, img);
+    munmap(img, size);
+#endif
+    return true;
+}
+
+bool dawnc_is_compiled(const char *path) {
+    char magic[4];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool is = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, DAWNC_MAGIC, 4) == 0;
+    close(fd);
+    return is;
+}
+
+bool dawn_load_song(const char *path, DawnSong *out) {
+    if (dawnc_is_compiled(path)) return dawnc_load(path, out);
+    return dawn_parse_file(path, out);
+}
@@ -0,0 +1,41 @@
+#include "event_queue.h"
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_CAPACITY - 1)
+
+void event_queue_init(EventQueue *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->drop, 0);
+}
+
+bool event_queue_push(EventQueue *q, const SynthEvent *ev) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head >= EVENT_QUEUE_CAPACITY) return false;
+    q->events[tail & EVENT_QUEUE_MASK] = *ev;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void event_queue_flush(EventQueue *q) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->drop, tail, memory_order_release);
+}
+
+const SynthEvent *event_queue_peek(EventQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t drop = atomic_load_explicit(&q->drop, memory_order_acquire);
+    if ((ptrdiff_t)(drop - head) > 0) {
+        /* counters are free-running: compare by difference */
+        head = drop;
+        atomic_store_explicit(&q->head, head, memory_order_release);
+    }
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) return NULL;
+    return &q->events[head & EVENT_QUEUE_MASK];
+}
+
+void event_queue_pop(EventQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
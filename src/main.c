@@ -3,7 +3,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include "audio.h"
+#include "batch.h"
+#include "control.h"
 #include "dawn_format.h"
+#include "dawnc.h"
+#include "reload.h"
+#include "render.h"
+#include "seek.h"
+#include "timeline.h"
+#include "workers.h"
 
 /* precise sleep */
 #define _POSIX_C_SOURCE 199309L   // MUST be before any #include
@@ -12,6 +20,7 @@
 #include <stdlib.h>
 #include <time.h>      // defines struct timespec + nanosleep
 #include <unistd.h>
+#include <signal.h>
 
 void precise_sleep(double seconds) {
     if (seconds <= 0) return;
@@ -23,115 +32,810 @@ void precise_sleep(double seconds) {
     nanosleep(&req, NULL);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s song.dawn\n", argv[0]);
-        return 1;
+/* The player runs this far ahead of the device clock; it only needs to
+   stay ahead of the next callback, events carry their own exact timestamps.
+   Two device buffers, plus 20 ms of slack for the player's own wakeups. */
+static uint64_t schedule_lookahead(const AudioConfig *cfg) {
+    return 2 * (uint64_t)cfg->buffer_frames + (uint64_t)cfg->sample_rate / 50;
+}
+
+/* SIGUSR1 asks for the audio callback statistics while playing */
+static volatile sig_atomic_t stats_requested;
+
+static void on_stats_signal(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+static void dump_audio_stats(void) {
+    AudioStats stats;
+    audio_get_stats(&stats);
+    audio_print_stats(stderr, &stats);
+}
+
+/* called from the playback wait loops; the signal cuts their sleeps short */
+static void poll_stats_request(void) {
+    if (stats_requested) {
+        stats_requested = 0;
+        dump_audio_stats();
     }
+}
 
-    DawnSong song;
-    if (!dawn_parse_file(argv[1], &song)) {
-        fprintf(stderr, "Failed to parse %s\n", argv[1]);
-        return 1;
+/* With a control socket the player has to notice commands well within
+   one audio buffer, so it never sleeps longer than this */
+#define CONTROL_WAIT_SECONDS 0.001
+
+/* sleep until the event at 'frame' is within the scheduling window;
+   false if a control command arrived first */
+static bool wait_for_frame(uint64_t frame, Controller *ctl) {
+    const AudioConfig *cfg = audio_config();
+    uint64_t lookahead = schedule_lookahead(cfg);
+    for (;;) {
+        poll_stats_request();
+        if (control_pending(ctl)) return false;
+        uint64_t played = audio_frames_played();
+        if (frame <= played + lookahead) return true;
+        double wait = (double)(frame - played - lookahead) / cfg->sample_rate;
+        precise_sleep(ctl && wait > CONTROL_WAIT_SECONDS ? CONTROL_WAIT_SECONDS : wait);
     }
+}
 
-    printf("Loaded '%s' BPM=%d TPB=%d channels=%d patterns=%d order=%d\n",
-        song.title, song.bpm, song.ticks_per_beat, song.channel_count, song.pattern_count, song.order_length);
+/* hand an event to the audio thread, waiting while its queue is full */
+static void schedule(const SynthEvent *ev) {
+    while (!audio_schedule(ev)) precise_sleep(0.001);
+}
 
-    /* initialize audio */
-    audio_init();
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
 
-    /* playback state for each channel */
-    int channel_pos[DAWN_MAX_CHANNELS];
-    int channel_remaining_ticks[DAWN_MAX_CHANNELS];
-    for (int c = 0; c < song.channel_count; c++) { channel_pos[c] = 0; channel_remaining_ticks[c] = 0; }
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--stats] [--rate HZ] [--channels N] [--buffer FRAMES] [--voices N]\n"
+                    "           [--start ORDER | --start-time SEC] [--loop FROM:TO] [--watch | --control SOCKET]\n"
+                    "           song.dawn|song.dawnc\n", prog);
+    fprintf(stderr, "       %s [--rate HZ] [--channels N] [--format f32|s16] [--voices N] [--threads N [--segments]] [--no-cache]\n"
+                    "           [--render-cache DIR [--render-cache-mb N]] --render out.wav|out.raw song.dawn|song.dawnc\n", prog);
+    fprintf(stderr, "       %s [--rate HZ] [--channels N] [--format f32|s16] [--voices N] [--no-cache]\n"
+                    "           [--render-cache DIR [--render-cache-mb N]] --stdout song.dawn|song.dawnc\n", prog);
+    fprintf(stderr, "       %s --compile song.dawn [-o song.dawnc]\n", prog);
+    fprintf(stderr, "       %s batch DIR|LIST --out DIR [-j N] [--rate HZ] [--voices N]\n"
+                    "           [--render-cache DIR [--render-cache-mb N]]\n", prog);
+}
 
-    double seconds_per_beat = 60.0 / (double)song.bpm;
-    /* interpret ticks per beat in file as beats per quarter note; we choose TICKS_PER_BEAT = song.ticks_per_beat */
-    int ticks_per_beat = song.ticks_per_beat > 0 ? song.ticks_per_beat : 4;
-    double seconds_per_tick = seconds_per_beat / (double)ticks_per_beat;
+/* Where playback starts and what it repeats, in ORDER entries (0-based) */
+typedef struct {
+    int start_order;       /* -1 if not given */
+    double start_time;     /* seconds, < 0 if not given */
+    int loop_from;         /* -1 for no loop */
+    int loop_to;           /* last entry of the loop, inclusive */
+} PlayRange;
 
-    int order_idx = 0;
+/* A song swapped out by a reload or an edit. Its seek index stays alive
+   until the device is past the last RESTORE event pointing into it. */
+typedef struct {
+    ReloadedSong *song;
+    uint64_t until;        /* device frame of that RESTORE, 0 if none */
+} Retired;
 
-    while (order_idx < song.order_length) {
-        /* find pattern by id */
-        int pid = song.order[order_idx];
-        DawnPattern *pat = NULL;
-        for (int i = 0; i < song.pattern_count; i++) {
-            if (song.patterns[i].id == pid) { pat = &song.patterns[i]; break; }
-        }
-        if (!pat) {
-            fprintf(stderr, "Pattern %d not found in song\n", pid);
-            order_idx++;
-            continue;
+static void retire(Retired *r, ReloadedSong *song, uint64_t until) {
+    while (r->song && audio_frames_played() <= r->until) precise_sleep(0.001);
+    reloaded_song_free(r->song);
+    r->song = song;
+    r->until = until;
+}
+
+/* Loop bounds in tl's frames; false if tl has no ORDER entry loop_to */
+static bool loop_bounds(const Timeline *tl, const PlayRange *range, uint64_t *start, uint64_t *end) {
+    if (range->loop_to >= tl->order_count) return false;
+    *start = tl->order_frames[range->loop_from];
+    *end = range->loop_to + 1 < tl->order_count ? tl->order_frames[range->loop_to + 1] : tl->song_frames;
+    return true;
+}
+
+/* The ORDER entry playing at song frame pos (0 if the song has none) */
+static int order_at(const Timeline *tl, uint64_t pos) {
+    int lo = 0, hi = tl->order_count - 1;
+    if (hi < 0) return 0;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (tl->order_frames[mid] <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Where song frame pos of a lands in b, a recompile of the same song:
+   the same ORDER entry, as many ticks into it (cut short if the entry got
+   shorter) */
+static uint64_t map_position(const Timeline *a, uint64_t pos, const Timeline *b) {
+    if (pos >= a->song_frames || a->order_count == 0) return b->song_frames;
+    int k = order_at(a, pos);
+    if (k >= b->order_count) return b->song_frames;
+    /* ticks through each tempo map, the fraction of a tick spread linearly */
+    double into = tempo_tick(&a->tempo, pos) - (double)a->order_ticks[k];
+    if (into < 0.0) into = 0.0;
+    uint64_t whole = (uint64_t)into;
+    uint64_t f0 = tempo_frame(&b->tempo, b->order_ticks[k] + whole);
+    uint64_t f1 = tempo_frame(&b->tempo, b->order_ticks[k] + whole + 1);
+    uint64_t at = f0 + (uint64_t)((into - (double)whole) * (double)(f1 - f0) + 0.5);
+    uint64_t end = k + 1 < b->order_count ? b->order_frames[k + 1] : b->song_frames;
+    return at < end ? at : end;
+}
+
+/* Playback state. The timeline changes under reloads (--watch) and
+   control commands (--control); device frame = base + song frame. */
+typedef struct {
+    const PlayRange *range;
+    int voices;
+    Reloader *rl;
+    Controller *ctl;
+
+    const Timeline *tl;
+    SeekIndex ix;              /* the original timeline's, built on first use */
+    ReloadedSong *cur;         /* the version playing, NULL for the original */
+    uint64_t restore_until;    /* last loop RESTORE into cur's index */
+    Retired retired;
+
+    uint64_t base;
+    int i;                     /* next event to schedule */
+    int order;                 /* ORDER entry playing */
+    bool loop;
+    uint64_t loop_start, loop_end;
+
+    bool stopped;
+    uint64_t stop_pos;         /* song frame play resumes at */
+    void *seek_state;          /* snapshot behind the last seek's RESTORE */
+    uint64_t seek_until;
+} Player;
+
+/* The seek index of the timeline playing, built on first use */
+static const SeekIndex *player_index(Player *p) {
+    if (p->cur) {
+        if (!p->cur->has_index) p->cur->has_index = seek_index_build(&p->cur->ix, &p->cur->tl, p->voices);
+        return p->cur->has_index ? &p->cur->ix : NULL;
+    }
+    if (!p->ix.first_event && !seek_index_build(&p->ix, p->tl, p->voices)) return NULL;
+    return &p->ix;
+}
+
+/* Jump to song frame pos at device frame 'at' (0: the next audio block
+   once the jump is ready): the synth state there is installed by a
+   RESTORE event, so playback picks up with the right notes held at the
+   right phases */
+static bool player_seek(Player *p, uint64_t pos, uint64_t at) {
+    const SeekIndex *ix = player_index(p);
+    Synth *s = ix ? malloc(sizeof(Synth)) : NULL;
+    if (!s) return false;
+    synth_init(s, p->tl->sample_rate);
+    synth_set_polyphony(s, p->voices);
+    int i = seek_synth(ix, pos, s);
+    void *state = malloc(synth_snapshot_size(s));
+    if (state) synth_snapshot(s, state);
+    free(s);
+    if (!state) {
+        fprintf(stderr, "dawn: out of memory\n");
+        return false;
+    }
+    /* the previous seek's snapshot may still be waiting for its RESTORE */
+    while (p->seek_state && audio_frames_played() <= p->seek_until) precise_sleep(0.001);
+    free(p->seek_state);
+    if (!at) at = audio_frames_played();
+    p->seek_state = state;
+    p->seek_until = at;
+    SynthEvent ev = { at, SYNTH_EV_RESTORE, 0, 0, 0.0f, INST_SINE, 0, SYNTH_NOTE_PLAIN, state };
+    schedule(&ev);
+    p->base = at - pos;
+    p->i = i;
+    p->order = order_at(p->tl, pos);
+    return true;
+}
+
+/* Carry on from the timeline playing, whose events before p->i are
+   applied, in n from its song frame 'start' at device frame 'at'. Chord
+   slots that sound different in the two at that point get n's note at
+   'at'; the rest keep playing untouched. */
+static void switch_song(Player *p, const Timeline *n, uint64_t start, uint64_t at) {
+    TimelineEvent was[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD], now[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD];
+    timeline_slots_before(p->tl, p->i, was);
+    int ni = n->event_count;
+    if (start < n->song_frames) {
+        ni = timeline_first_event(n, start);
+        timeline_slots_before(n, ni, now);
+    } else {
+        timeline_slots_before(n, 0, now);   /* past the end: all silent */
+    }
+    p->base = at - start;
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
+        for (int s = 0; s < DAWN_MAX_CHORD; s++) {
+            if (timeline_same_sound(&was[c][s], &now[c][s])) continue;
+            TimelineEvent te = now[c][s];
+            te.frame = start;
+            SynthEvent ev;
+            timeline_synth_event(n, &te, p->base, &ev);
+            schedule(&ev);
         }
+    }
+    p->i = ni;
+    p->order = order_at(n, start);
+}
+
+/* Make n the song playing; the one it replaces is freed once nothing
+   queued points into it */
+static void player_adopt(Player *p, ReloadedSong *n) {
+    retire(&p->retired, p->cur, p->restore_until);
+    p->cur = n;
+    p->restore_until = 0;
+    p->tl = &n->tl;
+    if (p->loop && !loop_bounds(p->tl, p->range, &p->loop_start, &p->loop_end)) {
+        fprintf(stderr, "dawn: the song has no ORDER entry %d now, leaving the loop\n", p->range->loop_to);
+        p->loop = false;
+    }
+}
 
-        /* reset per-channel positions for this pattern */
-        for (int c = 0; c < song.channel_count; c++) {
-            channel_pos[c] = 0;
-            channel_remaining_ticks[c] = 0;
+/* Back to the loop start, in the state it had there. A reloaded song
+   waiting now takes over here. False if a command came first. */
+static bool player_wrap(Player *p) {
+    uint64_t wrap = p->base + p->loop_end;
+    if (!wait_for_frame(wrap, p->ctl)) return false;
+    ReloadedSong *n = reload_take(p->rl);
+    if (n) {
+        uint64_t start, end;
+        if (!loop_bounds(&n->tl, p->range, &start, &end)) {
+            int k = p->range->loop_to + 1;
+            switch_song(p, &n->tl, k < n->tl.order_count ? n->tl.order_frames[k] : n->tl.song_frames, wrap);
+            player_adopt(p, n);
+            return true;
         }
+        player_adopt(p, n);
+    }
+    const SeekIndex *ix = player_index(p);
+    if (!ix) {
+        p->loop = false;
+        return true;
+    }
+    p->base = wrap - p->loop_start;
+    SynthEvent ev = { wrap, SYNTH_EV_RESTORE, 0, 0, 0.0f, INST_SINE, 0, SYNTH_NOTE_PLAIN,
+                      seek_order_state(ix, p->range->loop_from) };
+    schedule(&ev);
+    if (p->cur) p->restore_until = wrap;
+    p->i = ix->first_event[p->range->loop_from];
+    p->order = p->range->loop_from;
+    return true;
+}
+
+/* The song frame at device frame 'at' */
+static uint64_t player_pos(const Player *p, uint64_t at) {
+    if (p->stopped) return p->stop_pos;
+    int64_t pos = (int64_t)(at - p->base);
+    return pos < 0 ? 0 : (uint64_t)pos;
+}
+
+/* Carry on in an edited song right away, at the same ORDER entry and
+   tick. It comes compiled and indexed from the control thread, so the
+   events after the switch are not held up. */
+static void player_edit(Player *p, ReloadedSong *n) {
+    uint64_t at = audio_frames_played();
+    uint64_t pos = player_pos(p, at);
+    uint64_t start = map_position(p->tl, pos, &n->tl);
+    if (p->stopped) {
+        p->stop_pos = start < n->tl.song_frames ? start : 0;
+    } else {
+        audio_flush();
+        p->i = timeline_first_event(p->tl, pos);
+        switch_song(p, &n->tl, start, at);
+    }
+    player_adopt(p, n);
+}
+
+/* Carry out a control command from the next audio block on. False for quit. */
+static bool player_command(Player *p, ControlCommand *cmd) {
+    uint64_t pos;
+    switch (cmd->type) {
+        case CONTROL_PLAY:
+            if (p->stopped) {
+                audio_flush();
+                p->stopped = !player_seek(p, p->stop_pos, 0);
+            }
+            break;
+        case CONTROL_STOP:
+            if (!p->stopped) {
+                uint64_t at = audio_frames_played();
+                pos = player_pos(p, at);
+                audio_flush();
+                for (int c = 0; c < SYNTH_CHANNELS; c++) {
+                    SynthEvent ev = { at, SYNTH_EV_NOTE_OFF, c, -1, 0.0f, INST_SINE, 0, SYNTH_NOTE_PLAIN, NULL };
+                    schedule(&ev);
+                }
+                p->stopped = true;
+                p->stop_pos = pos < p->tl->song_frames ? pos : 0;
+            }
+            break;
+        case CONTROL_SEEK_ORDER:
+        case CONTROL_SEEK_TIME:
+            pos = cmd->type == CONTROL_SEEK_ORDER ? p->tl->order_frames[cmd->order]
+                                                  : (uint64_t)(cmd->seconds * p->tl->sample_rate + 0.5);
+            if (pos >= p->tl->song_frames) {
+                fprintf(stderr, "dawn: seek past the end of the song (%.2fs)\n",
+                    (double)p->tl->song_frames / p->tl->sample_rate);
+            } else if (p->stopped) {
+                p->stop_pos = pos;
+            } else {
+                audio_flush();
+                if (!player_seek(p, pos, 0)) p->stopped = true;
+            }
+            break;
+        case CONTROL_SONG:
+            player_edit(p, cmd->song);
+            break;
+        case CONTROL_QUIT:
+            audio_flush();
+            return false;
+    }
+    return true;
+}
+
+/* Schedule the song against the device clock. Starting anywhere but the
+   top, or looping, goes through the seek index (player_seek()).
+   With a reloader, a new version of the song takes over at the next ORDER
+   boundary (or loop wrap) after it arrives, at the same ORDER entry. With
+   a controller, commands are carried out as they come, and the player
+   waits for more once the song has ended; it returns on quit. */
+static bool play_timeline(const Timeline *tl, const PlayRange *range, int voices, Reloader *rl, Controller *ctl) {
+    Player p;
+    memset(&p, 0, sizeof(p));
+    p.range = range;
+    p.voices = voices;
+    p.rl = rl;
+    p.ctl = ctl;
+    p.tl = tl;
+    p.loop = range->loop_from >= 0;
+    if (p.loop) loop_bounds(tl, range, &p.loop_start, &p.loop_end);
+    uint64_t from = p.loop_start;
+    if (range->start_order >= 0) from = tl->order_frames[range->start_order];
+    else if (range->start_time >= 0.0) from = (uint64_t)(range->start_time * tl->sample_rate + 0.5);
+    if (p.loop && from >= p.loop_end) {
+        fprintf(stderr, "dawn: playback starts after the end of the loop\n");
+        return false;
+    }
 
-        /* compute max rows among channels */
-        int max_rows = 0;
-        for (int c = 0; c < song.channel_count; c++) {
-            int rc = pat->channels[c].row_count;
-            if (rc > max_rows) max_rows = rc;
+    /* start one buffer ahead of the device so the first notes are not late */
+    uint64_t at = audio_frames_played() + (uint64_t)audio_config()->buffer_frames;
+    bool ok = true;
+    if (from > 0 || p.loop) ok = player_seek(&p, from, at);
+    else p.base = at;
+    /* seeks from the control socket should not wait for the index */
+    if (ok && ctl) ok = player_index(&p) != NULL;
+
+    bool quit = false;
+    while (ok && !quit) {
+        ControlCommand cmd;
+        if (control_poll(ctl, &cmd)) {
+            quit = !player_command(&p, &cmd);
+            continue;
         }
-        /* Play this pattern until all channels consumed */
-        int pattern_done = 0;
-        while (!pattern_done) {
-            /* For each channel, if remaining ticks == 0, trigger next row (if any) */
-            for (int c = 0; c < song.channel_count; c++) {
-                if (channel_remaining_ticks[c] <= 0) {
-                    int pos = channel_pos[c];
-                    if (pos < pat->channels[c].row_count) {
-                        NoteEvent ev = pat->channels[c].rows[pos];
-                        /* if ev.frequency > 0 -> note; if ev.instr == INST_NOISE or ev.frequency==0 && token was x -> play noise */
-                        if (ev.instr == INST_NOISE) {
-                            /* play noise by setting channel with some frequency (we ignore freq for noise) */
-                            audio_set_channel(c, 440.0f, INST_NOISE);
-                        } else if (ev.frequency > 0.0f) {
-                            audio_set_channel(c, ev.frequency, ev.instr);
-                        } else {
-                            /* rest */
-                            audio_stop_channel(c);
-                        }
-                        /* if length_ticks not set in parsing (0), we default to 1 tick */
-                        int ticks = ev.length_ticks > 0 ? ev.length_ticks : 1;
-                        channel_remaining_ticks[c] = ticks;
-                        channel_pos[c]++;
-                    } else {
-                        /* no more rows for this channel: stop channel */
-                        audio_stop_channel(c);
-                        channel_remaining_ticks[c] = 0;
-                    }
+        if (p.stopped) {
+            poll_stats_request();
+            precise_sleep(CONTROL_WAIT_SECONDS);
+            continue;
+        }
+        const Timeline *cur = p.tl;
+        if (p.i < cur->event_count && (!p.loop || cur->events[p.i].frame < p.loop_end)) {
+            const TimelineEvent *te = &cur->events[p.i];
+            if (rl && p.order + 1 < cur->order_count && te->frame >= cur->order_frames[p.order + 1]) {
+                /* an ORDER boundary: the one place a reloaded song may come in */
+                while (p.order + 1 < cur->order_count && cur->order_frames[p.order + 1] <= te->frame) p.order++;
+                uint64_t boundary = p.base + cur->order_frames[p.order];
+                wait_for_frame(boundary, NULL);
+                ReloadedSong *n = reload_take(rl);
+                if (n) {
+                    int k = p.order;
+                    switch_song(&p, &n->tl, k < n->tl.order_count ? n->tl.order_frames[k] : n->tl.song_frames,
+                                boundary);
+                    player_adopt(&p, n);
                 }
+                continue;
             }
+            SynthEvent ev;
+            timeline_synth_event(cur, te, p.base, &ev);
+            if (!wait_for_frame(ev.frame, ctl)) continue;
+            schedule(&ev);
+            p.i++;
+            continue;
+        }
+        if (p.loop) {
+            player_wrap(&p);
+            continue;
+        }
+        if (!ctl) break;
+        /* the tail plays out; "play" starts over */
+        p.stopped = true;
+        p.stop_pos = 0;
+    }
 
-            /* sleep one tick */
-            precise_sleep(seconds_per_tick);
+    if (quit) {
+        /* let one callback take the flush before the snapshots go */
+        uint64_t flushed = audio_frames_played();
+        while (audio_frames_played() <= flushed) precise_sleep(0.001);
+    } else if (ok) {
+        /* let the device play out the tail (the RESTORE events are applied by now) */
+        uint64_t end_frame = p.base + p.tl->total_frames;
+        while (audio_frames_played() < end_frame) {
+            poll_stats_request();
+            precise_sleep(0.005);
+        }
+    }
+    retire(&p.retired, NULL, 0);
+    reloaded_song_free(p.cur);
+    seek_index_free(&p.ix);
+    while (p.seek_state && audio_frames_played() <= p.seek_until) precise_sleep(0.001);
+    free(p.seek_state);
+    return ok;
+}
 
-            /* decrement ticks */
-            for (int c = 0; c < song.channel_count; c++) {
-                if (channel_remaining_ticks[c] > 0) channel_remaining_ticks[c]--;
+/* "FROM:TO", both ORDER entries */
+static bool parse_loop_option(const char *value, PlayRange *range) {
+    char tail;
+    if (sscanf(value, "%d:%d%c", &range->loop_from, &range->loop_to, &tail) != 2 || range->loop_from < 0 ||
+        range->loop_to < range->loop_from) {
+        fprintf(stderr, "dawn: --loop takes FROM:TO, ORDER entries with FROM <= TO\n");
+        return false;
+    }
+    return true;
+}
+
+/* song.dawn -> song.dawnc; any other name just gains the suffix */
+static char *compiled_path_for(const char *song_path) {
+    size_t len = strlen(song_path);
+    char *path = malloc(len + sizeof(".dawnc"));
+    if (!path) return NULL;
+    memcpy(path, song_path, len + 1);
+    if (len >= 5 && strcmp(path + len - 5, ".dawn") == 0) strcat(path, "c");
+    else strcat(path, ".dawnc");
+    return path;
+}
+
+/* Offline render: no audio device, no sleeping. With no out_path the
+   samples stream to stdout, so the report goes to stderr. */
+static int render_main(const DawnSong *song, const char *out_path, const RenderOptions *opts) {
+    FILE *info = out_path ? stdout : stderr;
+    RenderStats stats;
+    double t0 = now_seconds();
+    bool ok = out_path ? dawn_render_file(song, out_path, opts, &stats) : dawn_render_stream(song, stdout, opts, &stats);
+    if (!ok) return 1;
+    double elapsed = now_seconds() - t0;
+
+    double audio_seconds = (double)stats.frames / (double)stats.sample_rate;
+    fprintf(info, "Rendered %llu frames (%.2fs of audio) to %s in %.3fs (%.0fx realtime)\n",
+        (unsigned long long)stats.frames, audio_seconds, out_path ? out_path : "stdout", elapsed,
+        elapsed > 0.0 ? audio_seconds / elapsed : 0.0);
+    if (stats.from_disk_cache) fprintf(info, "Copied from the render cache\n");
+    if (stats.threads > 1) fprintf(info, "Rendered on %d threads\n", stats.threads);
+    if (stats.cached_entries) fprintf(info, "%d ORDER entries copied from the pattern cache\n", stats.cached_entries);
+    if (stats.voices_stolen)
+        fprintf(info, "Voice pool exhausted: %llu notes stolen\n", (unsigned long long)stats.voices_stolen);
+    return 0;
+}
+
+/* option value in [min, max]; false (with a message) otherwise */
+static bool parse_int_option(const char *name, const char *value, int min, int max, int *out) {
+    char *end;
+    long v = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || v < min || v > max) {
+        fprintf(stderr, "dawn: %s must be between %d and %d\n", name, min, max);
+        return false;
+    }
+    *out = (int)v;
+    return true;
+}
+
+/* a song-provided setting (0 if unset) in [min, max] */
+static bool check_song_setting(const char *key, int value, int min, int max) {
+    if (value != 0 && (value < min || value > max)) {
+        fprintf(stderr, "dawn: song %s %d is out of range (%d..%d)\n", key, value, min, max);
+        return false;
+    }
+    return true;
+}
+
+/* Parse and validate once, save the result as a .dawnc image */
+static int compile_main(const DawnSong *song, const char *song_path, const char *out_path) {
+    char *default_path = NULL;
+    if (!out_path) {
+        default_path = compiled_path_for(song_path);
+        if (!default_path) {
+            fprintf(stderr, "dawn: out of memory\n");
+            return 1;
+        }
+        out_path = default_path;
+    }
+    bool ok = dawnc_write(song, out_path);
+    if (ok) printf("Compiled %s to %s\n", song_path, out_path);
+    free(default_path);
+    return ok ? 0 : 1;
+}
+
+/* dawn batch: render a directory or list of songs in one process */
+static int batch_main(int argc, char *argv[], const char *prog) {
+    const char *source = NULL;
+    BatchOptions opts = { NULL, 0, { 0, 0, 1, false, 0, RENDER_F32, 0, NULL } };
+    const char *cache_dir = NULL;
+    int cache_mb = RENDER_CACHE_DEFAULT_MB;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            opts.out_dir = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parse_int_option("-j", argv[++i], 0, WORKERS_MAX, &opts.jobs)) return 1;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--rate", argv[++i], AUDIO_MIN_SAMPLE_RATE, AUDIO_MAX_SAMPLE_RATE,
+                    &opts.render.sample_rate))
+                return 1;
+        } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--voices", argv[++i], 1, SYNTH_MAX_VOICES, &opts.render.voices)) return 1;
+        } else if (strcmp(argv[i], "--render-cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--render-cache-mb") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--render-cache-mb", argv[++i], 1, INT32_MAX, &cache_mb)) return 1;
+        } else if (argv[i][0] == '-' || source) {
+            usage(prog);
+            return 1;
+        } else {
+            source = argv[i];
+        }
+    }
+    if (!source || !opts.out_dir) {
+        usage(prog);
+        return 1;
+    }
+
+    if (cache_dir && !(opts.render.disk_cache = render_cache_open(cache_dir, (uint64_t)cache_mb << 20))) return 1;
+
+    BatchStats stats;
+    bool ok = batch_render(source, &opts, &stats);
+    render_cache_close(opts.render.disk_cache);
+    if (!ok) return 1;
+    printf("Batch: %d songs, %d failed, %.1fs of audio in %.2fs on %d thread(s) (%.1f songs/s, %.0fx realtime)\n",
+        stats.songs, stats.failed, stats.audio_seconds, stats.elapsed, stats.jobs,
+        stats.elapsed > 0.0 ? stats.songs / stats.elapsed : 0.0,
+        stats.elapsed > 0.0 ? stats.audio_seconds / stats.elapsed : 0.0);
+    if (cache_dir) printf("Batch: %d of %d songs copied from the render cache\n", stats.cached, stats.songs - stats.failed);
+    return stats.failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "batch") == 0) return batch_main(argc - 1, argv + 1, argv[0]);
+
+    const char *render_path = NULL;
+    const char *song_path = NULL;
+    const char *out_path = NULL;
+    bool compile = false;
+    bool print_stats = false;
+    bool watch = false;
+    const char *control_path = NULL;
+    int threads = -1;                  /* --threads; 0 means one per CPU */
+    bool segments = false;
+    bool no_cache = false;
+    const char *cache_dir = NULL;
+    int cache_mb = -1;                 /* --render-cache-mb */
+    bool to_stdout = false;
+    const char *format = NULL;
+    AudioConfig want = { 0, 0, 0, 0 }; /* command line; 0 defers to the song */
+    PlayRange range = { -1, -1.0, -1, -1 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--rate", argv[++i], AUDIO_MIN_SAMPLE_RATE, AUDIO_MAX_SAMPLE_RATE, &want.sample_rate))
+                return 1;
+        } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--channels", argv[++i], 1, AUDIO_MAX_CHANNELS, &want.channels)) return 1;
+        } else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--buffer", argv[++i], AUDIO_MIN_BUFFER_FRAMES, AUDIO_MAX_BUFFER_FRAMES,
+                    &want.buffer_frames))
+                return 1;
+        } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--voices", argv[++i], 1, SYNTH_MAX_VOICES, &want.voices)) return 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--threads", argv[++i], 0, WORKERS_MAX, &threads)) return 1;
+        } else if (strcmp(argv[i], "--segments") == 0) {
+            segments = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            no_cache = true;
+        } else if (strcmp(argv[i], "--render-cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--render-cache-mb") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--render-cache-mb", argv[++i], 1, INT32_MAX, &cache_mb)) return 1;
+        } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            render_path = argv[++i];
+        } else if (strcmp(argv[i], "--stdout") == 0) {
+            to_stdout = true;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format = argv[++i];
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            if (!parse_int_option("--start", argv[++i], 0, DAWN_MAX_ORDER - 1, &range.start_order)) return 1;
+        } else if (strcmp(argv[i], "--start-time") == 0 && i + 1 < argc) {
+            char *end;
+            const char *value = argv[++i];
+            range.start_time = strtod(value, &end);
+            if (*value == '\0' || *end != '\0' || !(range.start_time >= 0.0)) {
+                fprintf(stderr, "dawn: --start-time must be a number of seconds >= 0\n");
+                return 1;
             }
+        } else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            if (!parse_loop_option(argv[++i], &range)) return 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+            control_path = argv[++i];
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            song_path = argv[i];
+        }
+    }
+    bool offline = render_path || to_stdout;
+    bool positioned = range.start_order >= 0 || range.start_time >= 0.0 || range.loop_from >= 0;
+    if (!song_path) {
+        usage(argv[0]);
+        return 1;
+    }
+    /* options that only mean something for one mode */
+    if (!offline && (threads >= 0 || segments || no_cache || cache_dir || format)) {
+        fprintf(stderr, "dawn: --threads, --segments, --no-cache, --render-cache and --format need --render or --stdout\n");
+        return 1;
+    }
+    if (cache_mb > 0 && !cache_dir) {
+        fprintf(stderr, "dawn: --render-cache-mb needs --render-cache\n");
+        return 1;
+    }
+    if (out_path && !compile) {
+        fprintf(stderr, "dawn: -o needs --compile\n");
+        return 1;
+    }
+    if ((positioned || watch || control_path) && (offline || compile)) {
+        fprintf(stderr, "dawn: --start, --start-time, --loop, --watch and --control are for playback only\n");
+        return 1;
+    }
+    /* pairs that exclude each other */
+    if (compile && offline) {
+        fprintf(stderr, "dawn: --compile cannot be combined with --render or --stdout\n");
+        return 1;
+    }
+    if (render_path && to_stdout) {
+        fprintf(stderr, "dawn: --render and --stdout cannot be combined\n");
+        return 1;
+    }
+    if (range.start_order >= 0 && range.start_time >= 0.0) {
+        fprintf(stderr, "dawn: --start and --start-time cannot be combined\n");
+        return 1;
+    }
+    if (watch && control_path) {
+        fprintf(stderr, "dawn: --watch and --control cannot be combined\n");
+        return 1;
+    }
+    if (format && strcmp(format, "f32") != 0 && strcmp(format, "s16") != 0) {
+        fprintf(stderr, "dawn: --format must be f32 or s16\n");
+        return 1;
+    }
+
+    DawnSong song;
+    if (!dawn_load_song(song_path, &song)) {
+        fprintf(stderr, "Failed to load %s\n", song_path);
+        return 1;
+    }
+
+    /* stdout may be carrying the audio */
+    fprintf(to_stdout ? stderr : stdout, "Loaded '%s' BPM=%d TPB=%d channels=%d patterns=%d order=%d\n",
+        song.title, song.bpm, song.ticks_per_beat, song.channel_count, song.pattern_count, song.order_length);
 
-            /* check if all channels are done */
-            pattern_done = 1;
-            for (int c = 0; c < song.channel_count; c++) {
-                if (channel_pos[c] < pat->channels[c].row_count) { pattern_done = 0; break; }
-                if (channel_remaining_ticks[c] > 0) { pattern_done = 0; break; }
+    if (compile) {
+        int rc = compile_main(&song, song_path, out_path);
+        dawn_song_free(&song);
+        return rc;
+    }
+
+    /* the command line overrides the song, which overrides the defaults */
+    if (!want.sample_rate) want.sample_rate = song.sample_rate;
+    if (!want.channels) want.channels = song.output_channels;
+    if (!want.buffer_frames) want.buffer_frames = song.buffer_frames;
+    if (!check_song_setting("RATE", want.sample_rate, AUDIO_MIN_SAMPLE_RATE, AUDIO_MAX_SAMPLE_RATE) ||
+        !check_song_setting("OUTPUT_CHANNELS", want.channels, 1, AUDIO_MAX_CHANNELS) ||
+        !check_song_setting("BUFFER", want.buffer_frames, AUDIO_MIN_BUFFER_FRAMES, AUDIO_MAX_BUFFER_FRAMES)) {
+        dawn_song_free(&song);
+        return 1;
+    }
+
+    if (range.start_order >= song.order_length || range.loop_to >= song.order_length) {
+        fprintf(stderr, "dawn: the song has %d ORDER entries (0..%d)\n", song.order_length, song.order_length - 1);
+        dawn_song_free(&song);
+        return 1;
+    }
+
+    if (offline) {
+        RenderOptions opts = { want.sample_rate, want.voices, threads == 0 ? workers_cpu_count() : threads, segments,
+                               want.channels, format && strcmp(format, "s16") == 0 ? RENDER_S16 : RENDER_F32,
+                               no_cache ? -1 : 0, NULL };
+        if (cache_dir) {
+            uint64_t max_bytes = (uint64_t)(cache_mb > 0 ? cache_mb : RENDER_CACHE_DEFAULT_MB) << 20;
+            if (!(opts.disk_cache = render_cache_open(cache_dir, max_bytes))) {
+                dawn_song_free(&song);
+                return 1;
             }
         }
+        int rc = render_main(&song, render_path, &opts);
+        render_cache_close(opts.disk_cache);
+        dawn_song_free(&song);
+        return rc;
+    }
 
-        order_idx++;
+    /* open the device first: the song is compiled at whatever rate it gives */
+    AudioConfig have;
+    if (!audio_init(&want, &have)) {
+        dawn_song_free(&song);
+        return 1;
+    }
+    printf("Audio: %d Hz, %d channel(s), %d-frame buffer (%.1f ms)\n",
+        have.sample_rate, have.channels, have.buffer_frames, have.buffer_frames * 1000.0 / have.sample_rate);
+
+    Timeline tl;
+    bool compiled = timeline_compile(&song, have.sample_rate, &tl);
+    bool started = compiled;
+    bool own_song = true;
+    Reloader *rl = NULL;
+    Controller *ctl = NULL;
+    if (compiled && watch) {
+        /* the reloader keeps the song to compare new versions against */
+        rl = reload_start(song_path, &song, have.sample_rate, have.voices, range.loop_from >= 0);
+        own_song = false;
+        started = rl != NULL;
+        if (started) printf("Watching %s for changes\n", song_path);
+    } else if (compiled && control_path) {
+        /* the controller keeps the song: tempo and pattern commands edit it */
+        ctl = control_start(control_path, &song, have.sample_rate, have.voices);
+        own_song = false;
+        started = ctl != NULL;
+        if (started) printf("Listening for commands on %s\n", control_path);
+    }
+    if (own_song) dawn_song_free(&song);
+    if (!started) {
+        if (compiled) timeline_free(&tl);
+        audio_shutdown();
+        return 1;
+    }
+
+    /* no SA_RESTART: the signal should wake the player's sleeps */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stats_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    if (range.start_time >= 0.0 && range.start_time * tl.sample_rate >= (double)tl.song_frames) {
+        fprintf(stderr, "dawn: --start-time is past the end of the song (%.2fs)\n",
+            (double)tl.song_frames / tl.sample_rate);
+        reload_stop(rl);
+        control_stop(ctl);
+        timeline_free(&tl);
+        audio_shutdown();
+        return 1;
     }
+    bool played = play_timeline(&tl, &range, have.voices, rl, ctl);
+    reload_stop(rl);
+    control_stop(ctl);
+    timeline_free(&tl);
 
-    /* ensure channels are silenced */
-    for (int c = 0; c < song.channel_count; c++) audio_stop_channel(c);
+    if (print_stats) dump_audio_stats();
 
     audio_shutdown();
+    if (!played) return 1;
     printf("Playback finished.\n");
     return 0;
 }
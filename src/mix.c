@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <string.h>
+#include "mix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MIX_X86 1
+#include <immintrin.h>
+#endif
+
+/* add != 0 continues the sum already in dst instead of starting a new one */
+typedef void (*MixSumFn)(float *dst, const float *const *src, int count, int n, float gain, int add);
+typedef void (*MixRampFn)(float *buf, int n, float from, float step, int first);
+
+/* scalar reference, also used for the frames past the last full vector */
+static void sum_range(float *dst, const float *const *src, int count, int from, int n, float gain, int add) {
+    for (int i = from; i < n; i++) {
+        float acc = add ? dst[i] + src[0][i] * gain : src[0][i] * gain;
+        for (int k = 1; k < count; k++) acc += src[k][i] * gain;
+        dst[i] = acc;
+    }
+}
+
+static void mix_sum_scalar(float *dst, const float *const *src, int count, int n, float gain, int add) {
+    sum_range(dst, src, count, 0, n, gain, add);
+}
+
+static void ramp_range(float *buf, int from_i, int n, float from, float step, int first) {
+    for (int i = from_i; i < n; i++) buf[i] *= from + step * (float)(first + i);
+}
+
+static void mix_ramp_scalar(float *buf, int n, float from, float step, int first) {
+    ramp_range(buf, 0, n, from, step, first);
+}
+
+#ifdef MIX_X86
+__attribute__((target("sse2")))
+static void mix_sum_sse2(float *dst, const float *const *src, int count, int n, float gain, int add) {
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 acc = _mm_mul_ps(_mm_loadu_ps(src[0] + i), g);
+        if (add) acc = _mm_add_ps(_mm_loadu_ps(dst + i), acc);
+        for (int k = 1; k < count; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src[k] + i), g));
+        _mm_storeu_ps(dst + i, acc);
+    }
+    sum_range(dst, src, count, i, n, gain, add);
+}
+
+__attribute__((target("sse2")))
+static void mix_ramp_sse2(float *buf, int n, float from, float step, int first) {
+    __m128 f = _mm_set1_ps(from), s = _mm_set1_ps(step);
+    __m128i k = _mm_add_epi32(_mm_set1_epi32(first), _mm_setr_epi32(0, 1, 2, 3));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 g = _mm_add_ps(f, _mm_mul_ps(s, _mm_cvtepi32_ps(k)));
+        _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+        k = _mm_add_epi32(k, _mm_set1_epi32(4));
+    }
+    ramp_range(buf, i, n, from, step, first);
+}
+
+__attribute__((target("avx2")))
+static void mix_sum_avx2(float *dst, const float *const *src, int count, int n, float gain, int add) {
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 acc = _mm256_mul_ps(_mm256_loadu_ps(src[0] + i), g);
+        if (add) acc = _mm256_add_ps(_mm256_loadu_ps(dst + i), acc);
+        for (int k = 1; k < count; k++)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(src[k] + i), g));
+        _mm256_storeu_ps(dst + i, acc);
+    }
+    sum_range(dst, src, count, i, n, gain, add);
+}
+
+__attribute__((target("avx2")))
+static void mix_ramp_avx2(float *buf, int n, float from, float step, int first) {
+    __m256 f = _mm256_set1_ps(from), s = _mm256_set1_ps(step);
+    __m256i k = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 g = _mm256_add_ps(f, _mm256_mul_ps(s, _mm256_cvtepi32_ps(k)));
+        _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i), g));
+        k = _mm256_add_epi32(k, _mm256_set1_epi32(8));
+    }
+    ramp_range(buf, i, n, from, step, first);
+}
+#endif
+
+static MixSumFn sum_fn = mix_sum_scalar;
+static MixRampFn ramp_fn = mix_ramp_scalar;
+static const char *sum_name = "scalar";
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+
+static bool cpu_has(const char *name) {
+    if (strcmp(name, "scalar") == 0) return true;
+#ifdef MIX_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+static void set_kernel(const char *name) {
+#ifdef MIX_X86
+    if (strcmp(name, "avx2") == 0) { sum_fn = mix_sum_avx2; ramp_fn = mix_ramp_avx2; sum_name = "avx2"; return; }
+    if (strcmp(name, "sse2") == 0) { sum_fn = mix_sum_sse2; ramp_fn = mix_ramp_sse2; sum_name = "sse2"; return; }
+#endif
+    (void)name;
+    sum_fn = mix_sum_scalar;
+    ramp_fn = mix_ramp_scalar;
+    sum_name = "scalar";
+}
+
+static void dispatch(void) {
+    if (cpu_has("avx2")) set_kernel("avx2");
+    else if (cpu_has("sse2")) set_kernel("sse2");
+    else set_kernel("scalar");
+}
+
+void mix_sum(float *dst, const float *const *src, int count, int n, float gain) {
+    if (count <= 0) {
+        memset(dst, 0, sizeof(float) * (size_t)n);
+        return;
+    }
+    pthread_once(&dispatch_once, dispatch);
+    sum_fn(dst, src, count, n, gain, 0);
+}
+
+void mix_sum_add(float *dst, const float *const *src, int count, int n, float gain) {
+    if (count <= 0) return;
+    pthread_once(&dispatch_once, dispatch);
+    sum_fn(dst, src, count, n, gain, 1);
+}
+
+void mix_ramp(float *buf, int n, float from, float step, int first) {
+    pthread_once(&dispatch_once, dispatch);
+    ramp_fn(buf, n, from, step, first);
+}
+
+const char *mix_isa(void) {
+    pthread_once(&dispatch_once, dispatch);
+    return sum_name;
+}
+
+bool mix_select(const char *name) {
+    pthread_once(&dispatch_once, dispatch);
+    if (!name || !cpu_has(name)) return false;
+    set_kernel(name);
+    return true;
+}
@@ -0,0 +1,123 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <pthread.h>
+#include "osc.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define FRAC_BITS (32 - OSC_SINE_TABLE_BITS)
+#define FRAC_MASK ((1u << FRAC_BITS) - 1)
+
+/* one guard entry so interpolation never needs to wrap the index */
+static float sine_table[OSC_SINE_TABLE_SIZE + 1];
+static pthread_once_t sine_once = PTHREAD_ONCE_INIT;
+
+static void build_sine_table(void) {
+    for (int i = 0; i <= OSC_SINE_TABLE_SIZE; i++)
+        sine_table[i] = (float)sin(2.0 * M_PI * (double)i / OSC_SINE_TABLE_SIZE);
+}
+
+void osc_init(void) {
+    pthread_once(&sine_once, build_sine_table);
+}
+
+uint32_t osc_phase_inc(float freq, int sample_rate) {
+    if (freq <= 0.0f || sample_rate <= 0) return 0;
+    double cycles = (double)freq / (double)sample_rate;
+    return (uint32_t)(uint64_t)llround(cycles * 4294967296.0);
+}
+
+/* bipolar ramp: phase 0 -> -1, phase 2^31 -> 0 */
+static inline float phase_to_saw(uint32_t p) {
+    return (float)(int32_t)(p + 0x80000000u) * (1.0f / 2147483648.0f);
+}
+
+void osc_sine(float *out, int n, uint32_t *phase, uint32_t inc) {
+    uint32_t p = *phase;
+    for (int i = 0; i < n; i++) {
+        uint32_t idx = p >> FRAC_BITS;
+        float frac = (float)(p & FRAC_MASK) * (1.0f / (float)(1u << FRAC_BITS));
+        float a = sine_table[idx];
+        out[i] = a + (sine_table[idx + 1] - a) * frac;
+        p += inc;
+    }
+    *phase = p;
+}
+
+void osc_square(float *out, int n, uint32_t *phase, uint32_t inc) {
+    uint32_t p = *phase;
+    for (int i = 0; i < n; i++) {
+        out[i] = (float)(1 - 2 * (int32_t)(p >> 31));
+        p += inc;
+    }
+    *phase = p;
+}
+
+void osc_triangle(float *out, int n, uint32_t *phase, uint32_t inc) {
+    uint32_t p = *phase;
+    for (int i = 0; i < n; i++) {
+        out[i] = fabsf(phase_to_saw(p)) * 2.0f - 1.0f;
+        p += inc;
+    }
+    *phase = p;
+}
+
+void osc_saw(float *out, int n, uint32_t *phase, uint32_t inc) {
+    uint32_t p = *phase;
+    for (int i = 0; i < n; i++) {
+        out[i] = phase_to_saw(p);
+        p += inc;
+    }
+    *phase = p;
+}
+
+#define NOISE_WEYL 0x9e3779b9u
+
+void osc_noise_seed(OscNoise *ns, uint32_t seed) {
+    ns->seed = seed;
+    ns->counter = 0;
+}
+
+static inline uint32_t noise_hash(uint32_t x) {
+    x ^= x >> 16; x *= 0x7feb352du;
+    x ^= x >> 15; x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline float noise_sample(uint32_t seed, uint32_t k) {
+    return (float)(int32_t)noise_hash(seed + k * NOISE_WEYL) * (1.0f / 2147483648.0f);
+}
+
+#if defined(__GNUC__)
+typedef uint32_t noise_u32x4 __attribute__((vector_size(16)));
+typedef int32_t noise_i32x4 __attribute__((vector_size(16)));
+typedef float noise_f32x4 __attribute__((vector_size(16)));
+#endif
+
+void osc_noise(float *out, int n, OscNoise *ns) {
+    uint32_t seed = ns->seed;
+    uint32_t k = ns->counter;
+    int i = 0;
+
+#if defined(__GNUC__)
+    /* same arithmetic as noise_sample(), four samples per step */
+    noise_u32x4 x = { seed + (k + 0) * NOISE_WEYL, seed + (k + 1) * NOISE_WEYL,
+                      seed + (k + 2) * NOISE_WEYL, seed + (k + 3) * NOISE_WEYL };
+    const noise_u32x4 step = { 4 * NOISE_WEYL, 4 * NOISE_WEYL, 4 * NOISE_WEYL, 4 * NOISE_WEYL };
+    for (; i + 4 <= n; i += 4) {
+        noise_u32x4 h = x;
+        h ^= h >> 16; h *= 0x7feb352du;
+        h ^= h >> 15; h *= 0x846ca68bu;
+        h ^= h >> 16;
+        noise_f32x4 f = __builtin_convertvector((noise_i32x4)h, noise_f32x4) * (1.0f / 2147483648.0f);
+        __builtin_memcpy(out + i, &f, sizeof(f));
+        x += step;
+    }
+#endif
+    for (; i < n; i++) out[i] = noise_sample(seed, k + (uint32_t)i);
+
+    ns->counter = k + (uint32_t)n;
+}
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pattern_cache.h"
+
+typedef struct {
+    uint64_t hash;
+    PatternKey key;        /* events and state point into data */
+    PatternBlock block;    /* likewise */
+    size_t bytes;
+    uint64_t last_used;
+    void *data;            /* one allocation: events, pcm, state, end state */
+} CacheEntry;
+
+struct PatternCache {
+    size_t max_bytes;
+    size_t bytes;
+    uint64_t clock;        /* bumped on every hit and add */
+    CacheEntry *entries;
+    int count, cap;
+};
+
+/* FNV-1a */
+static uint64_t hash_bytes(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    for (size_t i = 0; i < n; i++) {
+        h ^= b[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* field by field: TimelineEvent has padding */
+static uint64_t hash_event(uint64_t h, const TimelineEvent *ev) {
+    h = hash_bytes(h, &ev->frame, sizeof(ev->frame));
+    h = hash_bytes(h, &ev->frequency, sizeof(ev->frequency));
+    const uint8_t rest[6] = { ev->channel, ev->slot, ev->instrument, ev->volume, ev->effect, ev->param };
+    h = hash_bytes(h, rest, sizeof(rest));
+    return hash_bytes(h, &ev->glide, sizeof(ev->glide));
+}
+
+static bool same_event(const TimelineEvent *a, const TimelineEvent *b) {
+    return a->frame == b->frame && memcmp(&a->frequency, &b->frequency, sizeof(float)) == 0 &&
+           a->channel == b->channel && a->slot == b->slot && a->instrument == b->instrument &&
+           a->volume == b->volume && a->effect == b->effect && a->param == b->param &&
+           memcmp(&a->glide, &b->glide, sizeof(float)) == 0;
+}
+
+static uint64_t hash_key(const PatternKey *key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = hash_bytes(h, &key->pattern, sizeof(key->pattern));
+    h = hash_bytes(h, &key->frames, sizeof(key->frames));
+    for (int i = 0; i < key->event_count; i++) h = hash_event(h, &key->events[i]);
+    return hash_bytes(h, key->state, key->state_size);
+}
+
+static bool same_key(const PatternKey *a, const PatternKey *b) {
+    if (a->pattern != b->pattern || a->frames != b->frames || a->event_count != b->event_count ||
+        a->state_size != b->state_size || memcmp(a->state, b->state, a->state_size) != 0)
+        return false;
+    for (int i = 0; i < a->event_count; i++)
+        if (!same_event(&a->events[i], &b->events[i])) return false;
+    return true;
+}
+
+PatternCache *pattern_cache_create(size_t max_bytes) {
+    PatternCache *c = calloc(1, sizeof(PatternCache));
+    if (c) c->max_bytes = max_bytes;
+    return c;
+}
+
+void pattern_cache_destroy(PatternCache *c) {
+    if (!c) return;
+    for (int i = 0; i < c->count; i++) free(c->entries[i].data);
+    free(c->entries);
+    free(c);
+}
+
+const PatternBlock *pattern_cache_find(PatternCache *c, const PatternKey *key) {
+    uint64_t h = hash_key(key);
+    for (int i = 0; i < c->count; i++) {
+        CacheEntry *e = &c->entries[i];
+        if (e->hash != h || !same_key(&e->key, key)) continue;
+        e->last_used = ++c->clock;
+        return &e->block;
+    }
+    return NULL;
+}
+
+static void evict_oldest(PatternCache *c) {
+    int victim = 0;
+    for (int i = 1; i < c->count; i++)
+        if (c->entries[i].last_used < c->entries[victim].last_used) victim = i;
+    c->bytes -= c->entries[victim].bytes;
+    free(c->entries[victim].data);
+    c->entries[victim] = c->entries[--c->count];
+}
+
+bool pattern_cache_add(PatternCache *c, const PatternKey *key, const float *pcm, const void *end_state,
+                       size_t end_size) {
+    size_t pcm_bytes = sizeof(float) * (size_t)key->frames;
+    size_t event_bytes = sizeof(TimelineEvent) * (size_t)key->event_count;
+    size_t bytes = pcm_bytes + event_bytes + key->state_size + end_size;
+    if (bytes > c->max_bytes) return false;
+    while (c->count > 0 && c->bytes + bytes > c->max_bytes) evict_oldest(c);
+
+    if (c->count == c->cap) {
+        int cap = c->cap ? c->cap * 2 : 16;
+        CacheEntry *entries = realloc(c->entries, sizeof(CacheEntry) * (size_t)cap);
+        if (!entries) return false;
+        c->entries = entries;
+        c->cap = cap;
+    }
+    /* events first: malloc's alignment suits them, and their size keeps the
+       samples after them aligned; the states are plain bytes */
+    unsigned char *data = malloc(bytes);
+    if (!data) return false;
+    unsigned char *p = data;
+    memcpy(p, key->events, event_bytes);
+    p += event_bytes;
+    memcpy(p, pcm, pcm_bytes);
+    p += pcm_bytes;
+    memcpy(p, key->state, key->state_size);
+    p += key->state_size;
+    memcpy(p, end_state, end_size);
+
+    CacheEntry *e = &c->entries[c->count++];
+    e->hash = hash_key(key);
+    e->key = *key;
+    e->key.events = (const TimelineEvent *)data;
+    e->key.state = data + event_bytes + pcm_bytes;
+    e->block.pcm = (const float *)(data + event_bytes);
+    e->block.end_state = p;
+    e->bytes = bytes;
+    e->last_used = ++c->clock;
+    e->data = data;
+    c->bytes += bytes;
+    return true;
+}
@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "dawnc.h"
+#include "reload.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/* Editors save in several steps (truncate, write, rename): the file is
+   re-loaded once it has been quiet this long */
+#define RELOAD_SETTLE_MS 50
+/* How often an idle watcher looks at the stop flag */
+#define RELOAD_POLL_MS 200
+
+struct Reloader {
+    char *path;
+    char *dir;                    /* watched: saves that rename over the file replace its inode */
+    const char *name;             /* file name within dir */
+    DawnSong song;                /* the version last handed over */
+    int sample_rate;
+    int voices;
+    bool index;
+    int fd;
+    pthread_t thread;
+    atomic_bool quit;
+    _Atomic(ReloadedSong *) ready;
+};
+
+/* What changed between two versions of a song */
+typedef struct {
+    int patterns;                 /* new or edited */
+    bool order;
+    bool settings;                /* tempo (and its changes), channels, instruments, envelopes, seed */
+} SongDiff;
+
+static bool same_pattern(const DawnSong *a, const DawnPattern *pa, const DawnSong *b, const DawnPattern *pb) {
+    for (int c = 0; c < a->channel_count; c++) {
+        uint32_t na, nb;
+        const DawnNote *ra = dawn_pattern_rows(a, pa, c, &na);
+        const DawnNote *rb = dawn_pattern_rows(b, pb, c, &nb);
+        if (na != nb || (na > 0 && memcmp(ra, rb, sizeof(DawnNote) * na) != 0)) return false;
+    }
+    return true;
+}
+
+static SongDiff diff_songs(const DawnSong *old, const DawnSong *cur) {
+    SongDiff d = { 0, false, false };
+    d.settings = old->bpm != cur->bpm || old->ticks_per_beat != cur->ticks_per_beat ||
+                 old->channel_count != cur->channel_count || old->seed != cur->seed ||
+                 old->tempo_change_count != cur->tempo_change_count ||
+                 memcmp(old->tempo_changes, cur->tempo_changes,
+                        sizeof(DawnTempoChange) * (size_t)cur->tempo_change_count) != 0;
+    for (int c = 0; !d.settings && c < cur->channel_count; c++) {
+        const DawnVoice *va = &old->channel_voices[c], *vb = &cur->channel_voices[c];
+        d.settings = old->channel_instruments[c] != cur->channel_instruments[c] || va->attack_ms != vb->attack_ms ||
+                     va->decay_ms != vb->decay_ms || va->release_ms != vb->release_ms ||
+                     va->sustain != vb->sustain || va->volume != vb->volume;
+    }
+    d.order = old->order_length != cur->order_length ||
+              memcmp(old->order, cur->order, sizeof(int32_t) * (size_t)cur->order_length) != 0;
+    for (int p = 0; p < cur->pattern_count; p++) {
+        const DawnPattern *pat = &cur->patterns[p];
+        const DawnPattern *was = dawn_song_pattern(old, pat->id);
+        if (!was || d.settings || !same_pattern(old, was, cur, pat)) d.patterns++;
+    }
+    return d;
+}
+
+void reloaded_song_free(ReloadedSong *s) {
+    if (!s) return;
+    if (s->has_index) seek_index_free(&s->ix);
+    timeline_free(&s->tl);
+    free(s);
+}
+
+/* Load the file again; if it changed, compile it and offer it to the player */
+static void reload_once(Reloader *rl) {
+    DawnSong song;
+    if (!dawn_load_song(rl->path, &song)) {
+        fprintf(stderr, "dawn: reload: %s did not load, still playing the previous version\n", rl->path);
+        return;
+    }
+    SongDiff d = diff_songs(&rl->song, &song);
+    if (d.patterns == 0 && !d.order && !d.settings) {
+        dawn_song_free(&song);
+        return;
+    }
+
+    ReloadedSong *s = calloc(1, sizeof(ReloadedSong));
+    bool ok = s && timeline_compile(&song, rl->sample_rate, &s->tl);
+    if (ok && rl->index) {
+        ok = seek_index_build(&s->ix, &s->tl, rl->voices);
+        s->has_index = ok;
+    }
+    if (!ok) {
+        if (s && s->tl.events) timeline_free(&s->tl);
+        free(s);
+        dawn_song_free(&song);
+        fprintf(stderr, "dawn: reload: out of memory, still playing the previous version\n");
+        return;
+    }
+    dawn_song_free(&rl->song);
+    rl->song = song;
+    fprintf(stderr, "dawn: reloaded %s: %d pattern(s) changed%s%s\n", rl->path, d.patterns,
+        d.order ? ", ORDER changed" : "", d.settings ? ", song settings changed" : "");
+
+    ReloadedSong *old = atomic_exchange(&rl->ready, s);
+    reloaded_song_free(old);
+}
+
+#ifdef __linux__
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *watch_main(void *arg) {
+    Reloader *rl = arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int64_t settle_at = -1;       /* when to reload, -1 if the file is unchanged */
+
+    while (!atomic_load(&rl->quit)) {
+        int timeout = RELOAD_POLL_MS;
+        if (settle_at >= 0) {
+            int64_t left = settle_at - now_ms();
+            timeout = left <= 0 ? 0 : left < RELOAD_POLL_MS ? (int)left : RELOAD_POLL_MS;
+        }
+        struct pollfd pfd = { rl->fd, POLLIN, 0 };
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno != EINTR) break;
+        if (n > 0) {
+            /* other files in the directory are busy too: only the song's events count */
+            ssize_t len = read(rl->fd, buf, sizeof(buf));
+            for (ssize_t at = 0; at < len;) {
+                const struct inotify_event *ev = (const struct inotify_event *)(buf + at);
+                if (ev->len > 0 && strcmp(ev->name, rl->name) == 0) settle_at = now_ms() + RELOAD_SETTLE_MS;
+                at += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+            }
+        }
+        if (settle_at >= 0 && now_ms() >= settle_at) {
+            settle_at = -1;
+            reload_once(rl);
+        }
+    }
+    return NULL;
+}
+
+Reloader *reload_start(const char *path, DawnSong *song, int sample_rate, int voices, bool index) {
+    Reloader *rl = calloc(1, sizeof(Reloader));
+    char *copy = malloc(strlen(path) + 3);
+    if (!rl || !copy) {
+        free(rl);
+        free(copy);
+        dawn_song_free(song);
+        fprintf(stderr, "dawn: out of memory\n");
+        return NULL;
+    }
+    /* "dir/name" -> path, dir and name in one buffer: "dir/name\0dir\0" or "name\0.\0" */
+    strcpy(copy, path);
+    const char *slash = strrchr(path, '/');
+    rl->path = copy;
+    rl->dir = copy + strlen(path) + 1;
+    if (slash) {
+        size_t n = (size_t)(slash - path);
+        memcpy(rl->dir, path, n ? n : 1);   /* "/name" lives in "/" */
+        rl->dir[n ? n : 1] = '\0';
+        rl->name = rl->path + (slash - path) + 1;
+    } else {
+        strcpy(rl->dir, ".");
+        rl->name = rl->path;
+    }
+    rl->song = *song;
+    rl->sample_rate = sample_rate;
+    rl->voices = voices;
+    rl->index = index;
+    atomic_init(&rl->quit, false);
+    atomic_init(&rl->ready, NULL);
+
+    rl->fd = inotify_init1(IN_CLOEXEC);
+    if (rl->fd < 0 || inotify_add_watch(rl->fd, rl->dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE) < 0 ||
+        pthread_create(&rl->thread, NULL, watch_main, rl) != 0) {
+        fprintf(stderr, "dawn: could not watch %s for changes\n", path);
+        if (rl->fd >= 0) close(rl->fd);
+        dawn_song_free(&rl->song);
+        free(rl->path);
+        free(rl);
+        return NULL;
+    }
+    return rl;
+}
+
+void reload_stop(Reloader *rl) {
+    if (!rl) return;
+    atomic_store(&rl->quit, true);
+    pthread_join(rl->thread, NULL);
+    close(rl->fd);
+    reloaded_song_free(atomic_exchange(&rl->ready, NULL));
+    dawn_song_free(&rl->song);
+    free(rl->path);
+    free(rl);
+}
+
+#else
+
+Reloader *reload_start(const char *path, DawnSong *song, int sample_rate, int voices, bool index) {
+    (void)sample_rate;
+    (void)voices;
+    (void)index;
+    (void)reload_once;
+    dawn_song_free(song);
+    fprintf(stderr, "dawn: watching %s needs inotify (Linux)\n", path);
+    return NULL;
+}
+
+void reload_stop(Reloader *rl) {
+    (void)rl;
+}
+
+#endif
+
+ReloadedSong *reload_take(Reloader *rl) {
+    if (!rl || !atomic_load_explicit(&rl->ready, memory_order_relaxed)) return NULL;
+    return atomic_exchange(&rl->ready, NULL);
+}
@@ -0,0 +1,575 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "pattern_cache.h"
+#include "render.h"
+#include "render_cache.h"
+#include "synth.h"
+#include "timeline.h"
+#include "mix.h"
+#include "workers.h"
+
+/* With fewer voices than this a block is rendered on the calling thread;
+   handing it out would cost more than it saves. */
+#define RENDER_PARALLEL_MIN_VOICES 4
+
+/* Misses in a row after which a pattern is no longer stored in the
+   pattern cache (it is still looked up); a pattern that misses this often
+   before its first hit is not looked up any more either */
+#define PATTERN_CACHE_MAX_MISSES 4
+
+typedef struct {
+    FILE *fp;
+    RenderFormat format;
+    int channels;
+    Synth synth;
+    float block[RENDER_BLOCK_FRAMES];
+    unsigned char pcm[RENDER_BLOCK_FRAMES * RENDER_MAX_CHANNELS * 4]; /* encoded frames */
+    uint64_t frames;       /* frames written so far */
+    bool ok;
+    RenderCacheEntry *store;  /* on-disk cache entry getting a copy of the output, if any */
+
+    /* multi-threaded rendering only */
+    WorkerPool *pool;
+    float (*rows)[RENDER_BLOCK_FRAMES];  /* one per active voice */
+    int span;              /* frames in the block being rendered */
+
+    /* rendered-pattern cache */
+    PatternCache *cache;
+    float *capture;        /* a copy of the audio from capture_start on, if not NULL */
+    uint64_t capture_start;
+    float *capture_buf;
+    size_t capture_cap;
+    TimelineEvent *rel;    /* the entry's events, relative to its start */
+    size_t rel_cap;        /* bytes, like the state buffers */
+    unsigned char *state;  /* snapshot at the entry start */
+    size_t state_cap;
+    unsigned char *end_state;
+    size_t end_cap;
+    int cached_entries;
+} Renderer;
+
+static void put_u16le(unsigned char *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }
+static void put_u32le(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24;
+}
+
+/* RIFF counts the data plus the 36 header bytes after its size field */
+#define WAV_MAX_DATA_BYTES (UINT32_MAX - 36)
+
+static int sample_bytes(RenderFormat format) {
+    return format == RENDER_S16 ? 2 : 4;
+}
+
+/* Output bytes, copied into the disk cache entry when there is one. A
+   cache write that fails only drops the entry. */
+static bool emit(Renderer *r, const void *p, size_t n) {
+    if (r->store && fwrite(p, 1, n, render_cache_entry_file(r->store)) != n) {
+        render_cache_discard(r->store);
+        r->store = NULL;
+    }
+    return fwrite(p, 1, n, r->fp) == n;
+}
+
+/* 44-byte canonical header: WAVE_FORMAT_IEEE_FLOAT or, for s16, PCM. Its
+   sizes are 32-bit: render_to() refuses data past WAV_MAX_DATA_BYTES. */
+static void wav_header(unsigned char h[44], int sample_rate, int channels, RenderFormat format, uint64_t frames) {
+    uint32_t frame_bytes = (uint32_t)(channels * sample_bytes(format));
+    uint32_t data_bytes = (uint32_t)(frames * frame_bytes);
+    memcpy(h, "RIFF", 4);
+    put_u32le(h + 4, 36 + data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32le(h + 16, 16);
+    put_u16le(h + 20, format == RENDER_S16 ? 1 : 3);  /* PCM or IEEE float */
+    put_u16le(h + 22, (uint16_t)channels);
+    put_u32le(h + 24, (uint32_t)sample_rate);
+    put_u32le(h + 28, (uint32_t)sample_rate * frame_bytes);
+    put_u16le(h + 32, (uint16_t)frame_bytes);
+    put_u16le(h + 34, (uint16_t)(sample_bytes(format) * 8));
+    memcpy(h + 36, "data", 4);
+    put_u32le(h + 40, data_bytes);
+}
+
+/* Encode n mono frames into the output format, one copy per channel, and
+   write them. A full pipe blocks here, which is all the backpressure a
+   streaming consumer needs. */
+static bool write_frames(Renderer *r, const float *buf, int n) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    if (r->format == RENDER_F32 && r->channels == 1)
+        return emit(r, buf, sizeof(float) * (size_t)n);
+#endif
+    unsigned char *p = r->pcm;
+    for (int i = 0; i < n; i++) {
+        if (r->format == RENDER_S16) {
+            float x = buf[i] > 1.0f ? 1.0f : buf[i] < -1.0f ? -1.0f : buf[i];
+            uint16_t v = (uint16_t)(int16_t)lrintf(x * 32767.0f);
+            for (int c = 0; c < r->channels; c++, p += 2) put_u16le(p, v);
+        } else {
+            uint32_t v;
+            memcpy(&v, &buf[i], 4);
+            for (int c = 0; c < r->channels; c++, p += 4) put_u32le(p, v);
+        }
+    }
+    return emit(r, r->pcm, (size_t)(p - r->pcm));
+}
+
+/* Worker share of a block: every count-th voice into its own row */
+static void render_rows_job(void *arg, int index, int count) {
+    Renderer *r = arg;
+    for (int k = index; k < r->synth.active_count; k += count)
+        synth_render_voice(&r->synth, k, r->rows[k], r->span);
+}
+
+/* Worker share of the reduction: a slice of frames, summed over every row
+   in active order like synth_render() does */
+static void mix_rows_job(void *arg, int index, int count) {
+    Renderer *r = arg;
+    const float *src[SYNTH_MAX_VOICES];
+    int from = (int)((int64_t)r->span * index / count) & ~7;
+    int to = index == count - 1 ? r->span : (int)((int64_t)r->span * (index + 1) / count) & ~7;
+    if (to <= from) return;
+    for (int k = 0; k < r->synth.active_count; k++) src[k] = r->rows[k] + from;
+    mix_sum(r->block + from, src, r->synth.active_count, to - from, SYNTH_GAIN);
+}
+
+/* Render up to n frames into r->block; returns how many. The parallel
+   path stops where a released note ends, as synth_render() does inside. */
+static int render_block(Renderer *r, int n) {
+    if (!r->pool || r->synth.active_count < RENDER_PARALLEL_MIN_VOICES) {
+        synth_render(&r->synth, r->block, n);
+        return n;
+    }
+    r->span = synth_span(&r->synth, n);
+    workers_run(r->pool, render_rows_job, r);
+    workers_run(r->pool, mix_rows_job, r);
+    synth_reap(&r->synth);
+    return r->span;
+}
+
+/* Render up to (not including) frame 'end' */
+static void render_until(Renderer *r, uint64_t end) {
+    while (r->ok && r->frames < end) {
+        uint64_t left = end - r->frames;
+        int n = render_block(r, left > RENDER_BLOCK_FRAMES ? RENDER_BLOCK_FRAMES : (int)left);
+        if (r->capture) memcpy(r->capture + (r->frames - r->capture_start), r->block, sizeof(float) * (size_t)n);
+        if (!write_frames(r, r->block, n)) r->ok = false;
+        r->frames += n;
+    }
+}
+
+/* Render up to frame 'stop', applying the events before it; *ev is the next event */
+static void render_events(Renderer *r, const Timeline *tl, int *ev, uint64_t stop) {
+    while (*ev < tl->event_count && tl->events[*ev].frame < stop && r->ok) {
+        const TimelineEvent *e = &tl->events[*ev];
+        render_until(r, e->frame);
+        SynthEvent se;
+        timeline_synth_event(tl, e, 0, &se);
+        synth_apply_event(&r->synth, &se);
+        (*ev)++;
+    }
+    render_until(r, stop);
+}
+
+/* ---- rendered-pattern cache ----
+
+   At the start of an ORDER entry whose pattern comes up more than once,
+   the synth is renumbered (synth_renumber()) and snapshotted. That state,
+   the pattern and the entry's events relative to its start decide every
+   sample of the entry, so a cache hit writes the stored samples and
+   restores the stored end state; a miss renders as usual and stores both.
+   The steal count is kept out of the key and added back afterwards.
+   Event frames are rounded from ticks, so where a tick is not a whole
+   number of frames the relative events (and with them the key) differ
+   between entries that start at different fractions of a frame. */
+
+static bool grow(void **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return true;
+    void *p = realloc(*buf, need);
+    if (!p) return false;
+    *buf = p;
+    *cap = need;
+    return true;
+}
+
+/* An ORDER entry playing 'pattern' over frames [start, end); the synth is
+   at start, before its events. On a miss the entry is stored if 'store'.
+   Returns true on a hit. */
+static bool render_entry_cached(Renderer *r, const Timeline *tl, int *ev, int pattern, uint64_t start, uint64_t end,
+                                bool store) {
+    int last = *ev;
+    while (last < tl->event_count && tl->events[last].frame < end) last++;
+    int count = last - *ev;
+    if (!grow((void **)&r->rel, &r->rel_cap, sizeof(TimelineEvent) * (size_t)(count > 0 ? count : 1))) {
+        render_events(r, tl, ev, end);
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        r->rel[i] = tl->events[*ev + i];
+        r->rel[i].frame -= start;
+    }
+
+    uint64_t stolen = r->synth.stolen;
+    r->synth.stolen = 0;
+    synth_renumber(&r->synth);
+    size_t state_size = synth_snapshot_size(&r->synth);
+    if (!grow((void **)&r->state, &r->state_cap, state_size)) {
+        r->synth.stolen = stolen;
+        render_events(r, tl, ev, end);
+        return false;
+    }
+    synth_snapshot(&r->synth, r->state);
+    PatternKey key = { pattern, end - start, r->rel, count, r->state, state_size };
+
+    const PatternBlock *hit = pattern_cache_find(r->cache, &key);
+    if (hit) {
+        for (uint64_t at = 0; r->ok && at < key.frames; at += RENDER_BLOCK_FRAMES) {
+            int n = key.frames - at > RENDER_BLOCK_FRAMES ? RENDER_BLOCK_FRAMES : (int)(key.frames - at);
+            if (!write_frames(r, hit->pcm + at, n)) r->ok = false;
+        }
+        r->frames = end;
+        synth_restore(&r->synth, hit->end_state);
+        *ev = last;
+        r->cached_entries++;
+    } else {
+        /* the capture buffer is kept between entries: no fresh pages per miss */
+        if (store && grow((void **)&r->capture_buf, &r->capture_cap, sizeof(float) * (size_t)key.frames)) {
+            r->capture = r->capture_buf;
+            r->capture_start = start;
+        }
+        render_events(r, tl, ev, end);
+        size_t end_size = synth_snapshot_size(&r->synth);
+        if (r->ok && r->capture && grow((void **)&r->end_state, &r->end_cap, end_size)) {
+            synth_snapshot(&r->synth, r->end_state);
+            pattern_cache_add(r->cache, &key, r->capture, r->end_state, end_size);
+        }
+        r->capture = NULL;
+    }
+    r->synth.stolen += stolen;
+    return hit != NULL;
+}
+
+static void render_song(Renderer *r, const Timeline *tl, const DawnSong *song) {
+    int ev = 0;
+    if (r->cache) {
+        /* only patterns that come up again are worth keeping. A note still
+           sounding at an entry's start (or one a new note retunes in place)
+           carries its phase in, and that state practically never comes
+           back: a pattern that keeps missing stops being stored, and one
+           that has never hit stops paying for the snapshot and lookup. */
+        int *uses = calloc(3 * DAWN_MAX_PATTERNS, sizeof(int));
+        int *misses = uses ? uses + DAWN_MAX_PATTERNS : NULL;
+        int *hits = uses ? uses + 2 * DAWN_MAX_PATTERNS : NULL;
+        for (int o = 0; uses && o < tl->order_count; o++)
+            if (song->order[o] >= 0 && song->order[o] < DAWN_MAX_PATTERNS) uses[song->order[o]]++;
+        for (int o = 0; uses && o < tl->order_count && r->ok; o++) {
+            uint64_t start = tl->order_frames[o];
+            uint64_t end = o + 1 < tl->order_count ? tl->order_frames[o + 1] : tl->song_frames;
+            int pattern = song->order[o];
+            render_events(r, tl, &ev, start);
+            if (end <= start || pattern < 0 || pattern >= DAWN_MAX_PATTERNS || uses[pattern] < 2) continue;
+            if (!hits[pattern] && misses[pattern] >= PATTERN_CACHE_MAX_MISSES) continue;
+            bool store = misses[pattern] < PATTERN_CACHE_MAX_MISSES;
+            if (render_entry_cached(r, tl, &ev, pattern, start, end, store)) {
+                misses[pattern] = 0;
+                hits[pattern]++;
+            } else {
+                misses[pattern]++;
+            }
+        }
+        free(uses);
+    }
+    render_events(r, tl, &ev, tl->total_frames);
+}
+
+/* ---- time-segmented rendering ----
+
+   The song is cut at ORDER entries into segments of at least
+   RENDER_SEGMENT_FRAMES. A single pass over the events, skipping the
+   audio with synth_skip(), yields the exact synth state at each cut, so
+   every segment renders on its own and the concatenation is the
+   sequential render sample for sample. Segments go out in waves of a few
+   per thread, which bounds the memory held for not yet written audio. */
+
+#define RENDER_SEGMENT_FRAMES (1u << 16)
+#define RENDER_SEGMENTS_PER_THREAD 4
+
+typedef struct {
+    uint64_t start, end;   /* frames [start, end) */
+    int first_event;       /* first event at or after start */
+    Synth synth;           /* state at start, before its events */
+    float *pcm;
+} Segment;
+
+typedef struct {
+    const Timeline *tl;
+    Segment *segs;
+    int count;
+    atomic_int next;
+} SegmentWave;
+
+static void apply_event(const Timeline *tl, const TimelineEvent *ev, Synth *s) {
+    SynthEvent se;
+    timeline_synth_event(tl, ev, 0, &se);
+    synth_apply_event(s, &se);
+}
+
+static void render_segment(const Timeline *tl, Segment *seg) {
+    const TimelineEvent *ev = tl->events + seg->first_event;
+    const TimelineEvent *end = tl->events + tl->event_count;
+    uint64_t pos = seg->start;
+
+    for (;;) {
+        uint64_t stop = ev < end && ev->frame < seg->end ? ev->frame : seg->end;
+        while (pos < stop) {
+            int n = stop - pos > RENDER_BLOCK_FRAMES ? RENDER_BLOCK_FRAMES : (int)(stop - pos);
+            synth_render(&seg->synth, seg->pcm + (pos - seg->start), n);
+            pos += (uint64_t)n;
+        }
+        if (pos == seg->end) break;
+        for (; ev < end && ev->frame == pos; ev++) apply_event(tl, ev, &seg->synth);
+    }
+}
+
+static void render_segments_job(void *arg, int index, int count) {
+    SegmentWave *w = arg;
+    (void)index;
+    (void)count;
+    int i;
+    while ((i = atomic_fetch_add(&w->next, 1)) < w->count) render_segment(w->tl, &w->segs[i]);
+}
+
+/* Where the segment starting at order entry o ends: the first order start
+   at least RENDER_SEGMENT_FRAMES on, or the song end */
+static int segment_end_order(const Timeline *tl, int o) {
+    uint64_t start = tl->order_frames[o];
+    while (++o < tl->order_count && tl->order_frames[o] - start < RENDER_SEGMENT_FRAMES) {}
+    return o;
+}
+
+static void render_song_segments(Renderer *r, const Timeline *tl) {
+    int threads = workers_count(r->pool);
+    int wave_cap = threads * RENDER_SEGMENTS_PER_THREAD;
+    Segment *segs = calloc((size_t)wave_cap, sizeof(Segment));
+    if (!segs) {
+        fprintf(stderr, "dawn: out of memory rendering segments\n");
+        r->ok = false;
+        return;
+    }
+
+    /* r->synth runs ahead of the audio: it only ever skips */
+    int next_event = 0;
+    int o = 0;
+    while (r->ok && r->frames < tl->total_frames) {
+        SegmentWave wave = { tl, segs, 0, 0 };
+        for (; wave.count < wave_cap && r->frames < tl->total_frames; wave.count++) {
+            Segment *seg = &segs[wave.count];
+            int next_o = o < tl->order_count ? segment_end_order(tl, o) : o;
+            seg->start = r->frames;
+            seg->end = next_o < tl->order_count ? tl->order_frames[next_o] : tl->total_frames;
+            seg->first_event = next_event;
+            seg->synth = r->synth;
+            seg->pcm = malloc(sizeof(float) * (size_t)(seg->end - seg->start));
+            if (!seg->pcm) {
+                fprintf(stderr, "dawn: out of memory rendering segments\n");
+                r->ok = false;
+                break;
+            }
+            /* carry the state to the segment end */
+            uint64_t pos = seg->start;
+            while (next_event < tl->event_count && tl->events[next_event].frame < seg->end) {
+                const TimelineEvent *ev = &tl->events[next_event++];
+                synth_skip(&r->synth, ev->frame - pos);
+                pos = ev->frame;
+                apply_event(tl, ev, &r->synth);
+            }
+            synth_skip(&r->synth, seg->end - pos);
+            r->frames = seg->end;
+            o = next_o;
+        }
+
+        if (r->ok) {
+            if (r->pool) workers_run(r->pool, render_segments_job, &wave);
+            else render_segments_job(&wave, 0, 1);
+        }
+        for (int i = 0; i < wave.count; i++) {
+            uint64_t len = segs[i].end - segs[i].start;
+            for (uint64_t at = 0; r->ok && at < len; at += RENDER_BLOCK_FRAMES) {
+                int n = len - at > RENDER_BLOCK_FRAMES ? RENDER_BLOCK_FRAMES : (int)(len - at);
+                if (!write_frames(r, segs[i].pcm + at, n)) r->ok = false;
+            }
+            free(segs[i].pcm);
+            segs[i].pcm = NULL;
+        }
+    }
+    free(segs);
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcasecmp(s + n - m, suffix) == 0;
+}
+
+static int output_channels(const RenderOptions *opts) {
+    int channels = opts && opts->channels > 0 ? opts->channels : 1;
+    return channels > RENDER_MAX_CHANNELS ? RENDER_MAX_CHANNELS : channels;
+}
+
+/* Render the song to r->fp; name is for messages. A WAV header needs a
+   seekable file: it is written first and patched at the end. */
+static bool render_to(Renderer *r, const DawnSong *song, const char *name, bool wav, const RenderOptions *opts,
+                      RenderStats *stats) {
+    Timeline tl;
+    int sample_rate = opts && opts->sample_rate > 0 ? opts->sample_rate : song->sample_rate;
+    if (!timeline_compile(song, sample_rate, &tl)) return false;
+
+    r->format = opts ? opts->format : RENDER_F32;
+    r->channels = output_channels(opts);
+    uint64_t frame_bytes = (uint64_t)r->channels * (uint64_t)sample_bytes(r->format);
+    if (wav && tl.total_frames > WAV_MAX_DATA_BYTES / frame_bytes) {
+        fprintf(stderr, "dawn: %s would need %.1f GiB of audio, past what a WAV file can hold; "
+            "render to a .raw file or --stdout instead\n", name, (double)tl.total_frames * (double)frame_bytes / (1u << 30));
+        timeline_free(&tl);
+        return false;
+    }
+    synth_init(&r->synth, tl.sample_rate);
+    if (opts && opts->voices > 0) synth_set_polyphony(&r->synth, opts->voices);
+    r->ok = true;
+
+    bool segments = opts && opts->segments;
+    int threads = opts && opts->threads > 1 ? opts->threads : 1;
+    if (threads > WORKERS_MAX) threads = WORKERS_MAX;
+    if (threads > 1) {
+        r->pool = workers_create(threads);
+        if (!segments) r->rows = malloc(sizeof(*r->rows) * SYNTH_MAX_VOICES);
+        if (!r->pool || (!segments && !r->rows)) {
+            fprintf(stderr, "dawn: could not start %d render threads, using one\n", threads);
+            workers_destroy(r->pool);
+            free(r->rows);
+            r->pool = NULL;
+            r->rows = NULL;
+            threads = 1;
+        }
+    }
+
+    int pattern_mb = opts && opts->pattern_cache_mb != 0 ? opts->pattern_cache_mb : PATTERN_CACHE_MB;
+    if (!segments && pattern_mb > 0) r->cache = pattern_cache_create((size_t)pattern_mb << 20);
+
+    /* placeholder header, patched with the real sizes once rendering is done */
+    unsigned char header[44];
+    wav_header(header, r->synth.sample_rate, r->channels, r->format, 0);
+    if (wav && !emit(r, header, sizeof(header))) r->ok = false;
+
+    if (segments) render_song_segments(r, &tl);
+    else render_song(r, &tl, song);
+    timeline_free(&tl);
+    workers_destroy(r->pool);
+    free(r->rows);
+    pattern_cache_destroy(r->cache);
+    free(r->capture_buf);
+    free(r->rel);
+    free(r->state);
+    free(r->end_state);
+
+    if (r->ok && wav) {
+        wav_header(header, r->synth.sample_rate, r->channels, r->format, r->frames);
+        if (fseek(r->fp, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), r->fp) != sizeof(header))
+            r->ok = false;
+        if (r->store && (!render_cache_entry_seek(r->store, 0) ||
+                         fwrite(header, 1, sizeof(header), render_cache_entry_file(r->store)) != sizeof(header))) {
+            render_cache_discard(r->store);
+            r->store = NULL;
+        }
+    }
+    if (fflush(r->fp) != 0) r->ok = false;
+    if (!r->ok) fprintf(stderr, "dawn: error writing %s\n", name);
+
+    if (stats) {
+        stats->frames = r->frames;
+        stats->sample_rate = r->synth.sample_rate;
+        stats->voices_stolen = r->synth.stolen;
+        stats->threads = threads;
+        stats->cached_entries = r->cached_entries;
+        stats->from_disk_cache = false;
+    }
+    return r->ok;
+}
+
+/* render_to() through the on-disk cache when opts has one: a hit copies
+   the stored output, a miss renders and stores a copy of what it wrote */
+static bool render_cached(Renderer *r, const DawnSong *song, const char *name, bool wav, const RenderOptions *opts,
+                          RenderStats *stats) {
+    RenderCache *cache = opts ? opts->disk_cache : NULL;
+    RenderCacheKey key;
+    if (!cache ||
+        !render_cache_key(song, opts->sample_rate > 0 ? opts->sample_rate : song->sample_rate,
+            opts->voices > 0 ? opts->voices : SYNTH_MAX_VOICES, output_channels(opts), (int)opts->format,
+            sample_bytes(opts->format), wav, &key))
+        return render_to(r, song, name, wav, opts, stats);
+
+    RenderCacheInfo info;
+    bool failed;
+    if (render_cache_fetch(cache, &key, r->fp, &info, &failed)) {
+        if (fflush(r->fp) != 0) {
+            fprintf(stderr, "dawn: error writing %s\n", name);
+            return false;
+        }
+        if (stats) {
+            memset(stats, 0, sizeof(*stats));
+            stats->frames = info.frames;
+            stats->sample_rate = info.sample_rate;
+            stats->voices_stolen = info.voices_stolen;
+            stats->threads = 1;
+            stats->from_disk_cache = true;
+        }
+        return true;
+    }
+    if (failed) {
+        fprintf(stderr, "dawn: error writing %s\n", name);
+        return false;
+    }
+
+    r->store = render_cache_begin(cache, &key);
+    bool ok = render_to(r, song, name, wav, opts, stats);
+    if (r->store) {
+        RenderCacheInfo done = { r->frames, r->synth.stolen, r->synth.sample_rate };
+        if (ok) render_cache_commit(r->store, &done);
+        else render_cache_discard(r->store);
+        r->store = NULL;
+    }
+    return ok;
+}
+
+bool dawn_render_file(const DawnSong *song, const char *path, const RenderOptions *opts, RenderStats *stats) {
+    if (!song || !path) return false;
+
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return false;
+    r->fp = fopen(path, "wb");
+    if (!r->fp) {
+        fprintf(stderr, "dawn: could not open %s for writing\n", path);
+        free(r);
+        return false;
+    }
+    bool ok = render_cached(r, song, path, has_suffix(path, ".wav"), opts, stats);
+    if (fclose(r->fp) != 0 && ok) {
+        fprintf(stderr, "dawn: error writing %s\n", path);
+        ok = false;
+    }
+    free(r);
+    return ok;
+}
+
+bool dawn_render_stream(const DawnSong *song, FILE *fp, const RenderOptions *opts, RenderStats *stats) {
+    if (!song || !fp) return false;
+
+    Renderer *r = calloc(1, sizeof(Renderer));
+    if (!r) return false;
+    r->fp = fp;
+    bool ok = render_cached(r, song, "output stream", false, opts, stats);
+    free(r);
+    return ok;
+}
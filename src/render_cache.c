@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "dawnc.h"
+#include "render_cache.h"
+
+/* Entry file: a 64-byte little-endian header, then the output bytes.
+   [0]  magic "DAWNRCE1"
+   [8]  u32 engine version
+   [12] u32 sample rate
+   [16] u64 hash[0], [24] u64 hash[1], [32] u64 song bytes
+   [40] u64 frames
+   [48] u64 voices stolen
+   [56] reserved */
+#define ENTRY_MAGIC "DAWNRCE1"
+#define ENTRY_HEADER 64
+#define ENTRY_SUFFIX ".dwr"
+#define TMP_PREFIX ".tmp-"
+#define TMP_STALE_SECONDS 3600   /* a temp file this old was left by a crashed render */
+#define COPY_CHUNK (64 * 1024)
+
+struct RenderCache {
+    char *dir;
+    uint64_t max_bytes;
+    pthread_mutex_t lock;
+    uint64_t bytes;            /* entries on disk, as of the last scan plus what this process added */
+};
+
+struct RenderCacheEntry {
+    RenderCache *cache;
+    RenderCacheKey key;
+    FILE *fp;
+    char *tmp_path;
+};
+
+typedef struct {
+    char *name;
+    uint64_t size;
+    struct timespec used;      /* mtime */
+} DiskEntry;
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/* dir/name, malloc'd */
+static char *join(const char *dir, const char *name) {
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path) sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+static char *entry_path(const RenderCache *c, const RenderCacheKey *key) {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx%016llx" ENTRY_SUFFIX, (unsigned long long)key->hash[0],
+        (unsigned long long)key->hash[1]);
+    return join(c->dir, name);
+}
+
+/* ---- hashing ----
+
+   Two 64-bit lanes over little-endian words: FNV-1a, and a multiply-xor
+   lane whose words go through the splitmix64 finalizer first, so the
+   lanes do not fail on the same inputs. */
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+typedef struct {
+    uint64_t a, b;
+} Hash128;
+
+static void hash_word(Hash128 *h, uint64_t w) {
+    h->a = (h->a ^ w) * 0x100000001b3ull;
+    h->b = (h->b ^ mix64(w)) * 0x9e3779b97f4a7c15ull;
+}
+
+static void hash_bytes(Hash128 *h, const unsigned char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) hash_word(h, get_u64(p + i));
+    uint64_t tail = 0;
+    for (size_t k = 0; i < n; i++, k++) tail |= (uint64_t)p[i] << (8 * k);
+    hash_word(h, tail ^ ((uint64_t)n << 56));
+}
+
+bool render_cache_key(const DawnSong *song, int sample_rate, int voices, int channels, int format, int sample_bytes,
+                      bool wav, RenderCacheKey *key) {
+    size_t size;
+    unsigned char *img = dawnc_serialize(song, &size);
+    if (!img) return false;
+    Hash128 h = { 0xcbf29ce484222325ull, 0x6a09e667f3bcc908ull };
+    hash_bytes(&h, img, size);
+    free(img);
+
+    uint64_t settings[] = { RENDER_ENGINE_VERSION, DAWNC_VERSION, (uint64_t)sample_rate, (uint64_t)voices,
+                            (uint64_t)channels, (uint64_t)format, wav ? 1u : 0u };
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) hash_word(&h, settings[i]);
+    key->hash[0] = mix64(h.a);
+    key->hash[1] = mix64(h.b ^ h.a);
+    key->song_bytes = size;
+    key->frame_bytes = (uint32_t)(channels * sample_bytes);
+    key->header_bytes = wav ? 44u : 0u;
+    return true;
+}
+
+/* ---- eviction ---- */
+
+static int cmp_used(const void *a, const void *b) {
+    const DiskEntry *x = a, *y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+/* Recount the entries on disk and remove the least recently used until
+   they fit; stale temp files go too. Call with the lock held. Entries
+   another process removes meanwhile just fail to unlink. */
+static void scan_and_evict(RenderCache *c) {
+    DIR *d = opendir(c->dir);
+    if (!d) return;
+    DiskEntry *list = NULL;
+    int count = 0, cap = 0;
+    uint64_t total = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        bool tmp = strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0;
+        if (!tmp && (de->d_name[0] == '.' || !has_suffix(de->d_name, ENTRY_SUFFIX))) continue;
+        char *path = join(c->dir, de->d_name);
+        struct stat st;
+        if (!path || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (tmp) {
+            if (now.tv_sec - st.st_mtim.tv_sec > TMP_STALE_SECONDS) unlink(path);
+            free(path);
+            continue;
+        }
+        if (count == cap) {
+            int ncap = cap ? cap * 2 : 64;
+            DiskEntry *grown = realloc(list, sizeof(DiskEntry) * (size_t)ncap);
+            if (!grown) {
+                free(path);
+                break;
+            }
+            list = grown;
+            cap = ncap;
+        }
+        list[count].name = path;
+        list[count].size = (uint64_t)st.st_size;
+        list[count].used = st.st_mtim;
+        total += (uint64_t)st.st_size;
+        count++;
+    }
+    closedir(d);
+
+    if (total > c->max_bytes) {
+        qsort(list, (size_t)count, sizeof(DiskEntry), cmp_used);
+        for (int i = 0; i < count && total > c->max_bytes; i++) {
+            if (unlink(list[i].name) == 0 || errno == ENOENT) total -= list[i].size;
+        }
+    }
+    for (int i = 0; i < count; i++) free(list[i].name);
+    free(list);
+    c->bytes = total;
+}
+
+/* ---- cache ---- */
+
+RenderCache *render_cache_open(const char *dir, uint64_t max_bytes) {
+    struct stat st;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "dawn: could not create render cache %s\n", dir);
+        return NULL;
+    }
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "dawn: render cache %s is not a directory\n", dir);
+        return NULL;
+    }
+    RenderCache *c = calloc(1, sizeof(RenderCache));
+    if (!c || !(c->dir = malloc(strlen(dir) + 1))) {
+        free(c);
+        fprintf(stderr, "dawn: out of memory\n");
+        return NULL;
+    }
+    strcpy(c->dir, dir);
+    c->max_bytes = max_bytes;
+    pthread_mutex_init(&c->lock, NULL);
+    scan_and_evict(c);
+    return c;
+}
+
+void render_cache_close(RenderCache *c) {
+    if (!c) return;
+    pthread_mutex_destroy(&c->lock);
+    free(c->dir);
+    free(c);
+}
+
+bool render_cache_fetch(RenderCache *c, const RenderCacheKey *key, FILE *fp, RenderCacheInfo *info, bool *failed) {
+    *failed = false;
+    char *path = entry_path(c, key);
+    FILE *in = path ? fopen(path, "rb") : NULL;
+    if (!in) {
+        free(path);
+        return false;
+    }
+
+    unsigned char h[ENTRY_HEADER];
+    if (fread(h, 1, sizeof(h), in) != sizeof(h) || memcmp(h, ENTRY_MAGIC, 8) != 0 ||
+        get_u32(h + 8) != RENDER_ENGINE_VERSION || get_u64(h + 16) != key->hash[0] ||
+        get_u64(h + 24) != key->hash[1] || get_u64(h + 32) != key->song_bytes) {
+        fclose(in);
+        free(path);
+        return false;
+    }
+    /* a short or overlong entry (a damaged disk, a crash before this
+       version synced its writes) would be copied out as a broken file */
+    struct stat st;
+    uint64_t frames = get_u64(h + 40);
+    bool sized = fstat(fileno(in), &st) == 0 && key->frame_bytes > 0 &&
+                 frames <= (UINT64_MAX - ENTRY_HEADER - key->header_bytes) / key->frame_bytes &&
+                 (uint64_t)st.st_size == ENTRY_HEADER + key->header_bytes + frames * key->frame_bytes;
+    if (!sized) {
+        fclose(in);
+        unlink(path);
+        free(path);
+        return false;
+    }
+    free(path);
+    /* a hit counts as a use for eviction */
+    futimens(fileno(in), NULL);
+
+    unsigned char *buf = malloc(COPY_CHUNK);
+    bool ok = buf != NULL;
+    size_t n;
+    while (ok && (n = fread(buf, 1, COPY_CHUNK, in)) > 0) ok = fwrite(buf, 1, n, fp) == n;
+    if (ok && ferror(in)) ok = false;
+    free(buf);
+    fclose(in);
+    if (!ok) {
+        *failed = true;
+        return false;
+    }
+    info->sample_rate = (int)get_u32(h + 12);
+    info->frames = frames;
+    info->voices_stolen = get_u64(h + 48);
+    return true;
+}
+
+RenderCacheEntry *render_cache_begin(RenderCache *c, const RenderCacheKey *key) {
+    RenderCacheEntry *e = calloc(1, sizeof(RenderCacheEntry));
+    if (!e) return NULL;
+    e->cache = c;
+    e->key = *key;
+    e->tmp_path = join(c->dir, TMP_PREFIX "XXXXXX");
+    int fd = e->tmp_path ? mkstemp(e->tmp_path) : -1;
+    if (fd < 0) {
+        free(e->tmp_path);
+        e->tmp_path = NULL;
+    } else {
+        fchmod(fd, 0644);  /* mkstemp makes it private; entries are shared */
+        if (!(e->fp = fdopen(fd, "w+b"))) close(fd);
+    }
+    /* the header is written on commit */
+    unsigned char h[ENTRY_HEADER] = { 0 };
+    if (!e->fp || fwrite(h, 1, sizeof(h), e->fp) != sizeof(h)) {
+        render_cache_discard(e);
+        return NULL;
+    }
+    return e;
+}
+
+FILE *render_cache_entry_file(RenderCacheEntry *e) {
+    return e->fp;
+}
+
+bool render_cache_entry_seek(RenderCacheEntry *e, long offset) {
+    return fseek(e->fp, ENTRY_HEADER + offset, SEEK_SET) == 0;
+}
+
+void render_cache_commit(RenderCacheEntry *e, const RenderCacheInfo *info) {
+    unsigned char h[ENTRY_HEADER] = { 0 };
+    memcpy(h, ENTRY_MAGIC, 8);
+    put_u32(h + 8, RENDER_ENGINE_VERSION);
+    put_u32(h + 12, (uint32_t)info->sample_rate);
+    put_u64(h + 16, e->key.hash[0]);
+    put_u64(h + 24, e->key.hash[1]);
+    put_u64(h + 32, e->key.song_bytes);
+    put_u64(h + 40, info->frames);
+    put_u64(h + 48, info->voices_stolen);
+
+    bool ok = fseek(e->fp, 0, SEEK_END) == 0;
+    long size = ok ? ftell(e->fp) : -1;
+    ok = ok && size >= ENTRY_HEADER && fseek(e->fp, 0, SEEK_SET) == 0 && fwrite(h, 1, sizeof(h), e->fp) == sizeof(h);
+    /* on disk before it has a name: a crash must not leave an empty entry
+       where readers look */
+    ok = ok && fflush(e->fp) == 0 && fsync(fileno(e->fp)) == 0;
+    if (fclose(e->fp) != 0) ok = false;
+    e->fp = NULL;
+    char *path = ok ? entry_path(e->cache, &e->key) : NULL;
+    if (path && rename(e->tmp_path, path) == 0) {
+        RenderCache *c = e->cache;
+        free(e->tmp_path);
+        e->tmp_path = NULL;
+        pthread_mutex_lock(&c->lock);
+        c->bytes += (uint64_t)size;
+        if (c->bytes > c->max_bytes) scan_and_evict(c);
+        pthread_mutex_unlock(&c->lock);
+    }
+    free(path);
+    render_cache_discard(e);
+}
+
+void render_cache_discard(RenderCacheEntry *e) {
+    if (!e) return;
+    if (e->fp) fclose(e->fp);
+    if (e->tmp_path) unlink(e->tmp_path);
+    free(e->tmp_path);
+    free(e);
+}
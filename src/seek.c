@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "seek.h"
+
+static void apply_event(const Timeline *tl, const TimelineEvent *ev, Synth *s) {
+    SynthEvent se;
+    timeline_synth_event(tl, ev, 0, &se);
+    synth_apply_event(s, &se);
+}
+
+/* Skip from frame 'pos' to 'frame', applying the events before it; returns the next event */
+static int advance(const Timeline *tl, Synth *s, int ev, uint64_t pos, uint64_t frame) {
+    for (; ev < tl->event_count && tl->events[ev].frame < frame; ev++) {
+        synth_skip(s, tl->events[ev].frame - pos);
+        pos = tl->events[ev].frame;
+        apply_event(tl, &tl->events[ev], s);
+    }
+    synth_skip(s, frame - pos);
+    return ev;
+}
+
+bool seek_index_build(SeekIndex *ix, const Timeline *tl, int voices) {
+    memset(ix, 0, sizeof(*ix));
+    ix->tl = tl;
+    size_t n = (size_t)(tl->order_count > 0 ? tl->order_count : 1);
+    ix->first_event = malloc(sizeof(int) * n);
+    ix->state_offset = malloc(sizeof(size_t) * n);
+    Synth *s = malloc(sizeof(Synth));
+    size_t size = 0, cap = 0;
+    bool ok = ix->first_event && ix->state_offset && s;
+    if (ok) {
+        synth_init(s, tl->sample_rate);
+        if (voices > 0) synth_set_polyphony(s, voices);
+    }
+
+    int ev = 0;
+    uint64_t pos = 0;
+    for (int o = 0; o < tl->order_count && ok; o++) {
+        ev = advance(tl, s, ev, pos, tl->order_frames[o]);
+        pos = tl->order_frames[o];
+        ix->first_event[o] = ev;
+
+        size_t need = synth_snapshot_size(s);
+        if (size + need > cap) {
+            size_t ncap = cap ? cap * 2 : 64 * 1024;
+            while (ncap < size + need) ncap *= 2;
+            unsigned char *states = realloc(ix->states, ncap);
+            if (!states) { ok = false; break; }
+            ix->states = states;
+            cap = ncap;
+        }
+        synth_snapshot(s, ix->states + size);
+        ix->state_offset[o] = size;
+        size += need;
+    }
+    free(s);
+    if (!ok) {
+        fprintf(stderr, "dawn: out of memory building the seek index\n");
+        seek_index_free(ix);
+    }
+    return ok;
+}
+
+void seek_index_free(SeekIndex *ix) {
+    if (!ix) return;
+    free(ix->first_event);
+    free(ix->state_offset);
+    free(ix->states);
+    ix->first_event = NULL;
+    ix->state_offset = NULL;
+    ix->states = NULL;
+}
+
+int seek_order_at(const SeekIndex *ix, uint64_t frame) {
+    const uint64_t *starts = ix->tl->order_frames;
+    int lo = 0, hi = ix->tl->order_count - 1;
+    if (hi < 0) return 0;
+    /* last entry starting at or before frame */
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (starts[mid] <= frame) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+const void *seek_order_state(const SeekIndex *ix, int order) {
+    return ix->states + ix->state_offset[order];
+}
+
+int seek_synth(const SeekIndex *ix, uint64_t frame, Synth *s) {
+    const Timeline *tl = ix->tl;
+    if (tl->order_count == 0) return advance(tl, s, 0, 0, frame);
+    int o = seek_order_at(ix, frame);
+    synth_restore(s, seek_order_state(ix, o));
+    return advance(tl, s, ix->first_event[o], tl->order_frames[o], frame);
+}
@@ -1,4 +1,6 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -6,6 +8,7 @@
 #include "sequencer.h"
 #include "audio.h"
 #include <stdlib.h>
+#include <pthread.h>
 
 /* internal helpers */
 static int parse_length_token(const char *tok, int ticks_per_beat) {
@@ -35,13 +38,19 @@ static int parse_length_token(const char *tok, int ticks_per_beat) {
     return ticks_per_beat;
 }
 
-/* sleep for given seconds (double) using nanosleep */
-static void precise_sleep(double seconds) {
-    if (seconds <= 0.0) return;
-    struct timespec req;
-    req.tv_sec = (time_t)seconds;
-    req.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
-    nanosleep(&req, NULL);
+/* sleep until 'ns' on the CLOCK_MONOTONIC timeline; absolute, so a late
+   wakeup is never carried into the next deadline */
+static void sleep_until_ns(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000u);
+    ts.tv_nsec = (long)(ns % 1000000000u);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
 
 /* Sequencer API implementations */
@@ -62,13 +71,37 @@ void sequencer_init(Sequencer *s, int bpm) {
     for (int c = 0; c < DAWN_CHANNELS; c++) {
         s->channel_pos[c] = 0;
         s->channel_remaining_ticks[c] = 0;
+        s->channel_idle[c] = 0;
     }
 }
 
+void sequencer_free(Sequencer *s) {
+    if (!s) return;
+    free(s->rows);
+    s->rows = NULL;
+    s->row_count = 0;
+    s->row_cap = 0;
+}
+
 void sequencer_add_pattern(Sequencer *s, Pattern *p) {
     if (!s || !p) return;
     if (s->pattern_count >= MAX_PATTERNS) return;
-    s->patterns[s->pattern_count++] = *p;
+    int n = p->row_count < 0 ? 0 : (p->row_count > MAX_PATTERN_ROWS ? MAX_PATTERN_ROWS : p->row_count);
+    if (s->row_count + n > s->row_cap) {
+        int cap = s->row_cap ? s->row_cap : 256;
+        while (cap < s->row_count + n) cap *= 2;
+        NoteEvent *rows = realloc(s->rows, sizeof(NoteEvent) * (size_t)cap);
+        if (!rows) return;
+        s->rows = rows;
+        s->row_cap = cap;
+    }
+    memcpy(&s->rows[s->row_count], p->rows, sizeof(NoteEvent) * (size_t)n);
+
+    SequencerPattern *sp = &s->patterns[s->pattern_count++];
+    sp->id = p->id;
+    sp->row_count = n;
+    sp->first_row = s->row_count;
+    s->row_count += n;
 }
 
 void sequencer_set_order(Sequencer *s, int *order, int order_len) {
@@ -79,13 +112,26 @@ void sequencer_set_order(Sequencer *s, int *order, int order_len) {
 }
 
 /* find pattern pointer by id (pattern.id) */
-static Pattern * find_pattern(Sequencer *s, int id) {
+static SequencerPattern * find_pattern(Sequencer *s, int id) {
     for (int i = 0; i < s->pattern_count; i++) {
         if (s->patterns[i].id == id) return &s->patterns[i];
     }
     return NULL;
 }
 
+/* Resolve the pattern for s->order_index, skipping ids that do not exist.
+   Returns 0 (and leaves current_pattern NULL) when the order is exhausted. */
+static int enter_order_entry(Sequencer *s) {
+    s->current_pattern = NULL;
+    while (s->order_index < s->order_length) {
+        s->current_pattern_id = s->order[s->order_index];
+        s->current_pattern = find_pattern(s, s->current_pattern_id);
+        if (s->current_pattern) return 1;
+        s->order_index++;
+    }
+    return 0;
+}
+
 void sequencer_start(Sequencer *s) {
     if (!s) return;
     s->is_playing = 1;
@@ -94,7 +140,9 @@ void sequencer_start(Sequencer *s) {
     for (int c = 0; c < DAWN_CHANNELS; c++) {
         s->channel_pos[c] = 0;
         s->channel_remaining_ticks[c] = 0;
+        s->channel_idle[c] = 0;
     }
+    enter_order_entry(s);
 }
 
 /* Stop playback and silence channels */
@@ -109,28 +157,20 @@ void sequencer_stop(Sequencer *s) {
 /* Advance one tick: check each channel for event boundaries and trigger notes */
 static void sequencer_advance_tick(Sequencer *s) {
     if (!s || !s->is_playing) return;
-    if (s->order_index >= s->order_length) {
+    SequencerPattern *pat = s->current_pattern;
+    if (!pat) {
         /* nothing more to play */
         sequencer_stop(s);
         return;
     }
 
-    Pattern *pat = find_pattern(s, s->order[s->order_index]);
-    if (!pat) {
-        /* advance to next pattern in order */
-        s->order_index++;
-        if (s->order_index >= s->order_length) { sequencer_stop(s); return; }
-        pat = find_pattern(s, s->order[s->order_index]);
-        if (!pat) { sequencer_stop(s); return; }
-    }
-
     /* For each channel: if no remaining ticks, try to start next row (if exists) */
     for (int ch = 0; ch < DAWN_CHANNELS; ch++) {
         if (s->channel_remaining_ticks[ch] <= 0) {
             /* compute row index for this channel relative to current pattern */
             int row = s->channel_pos[ch];
             if (row < pat->row_count) {
-                NoteEvent *ev = &pat->rows[row];
+                NoteEvent *ev = &s->rows[pat->first_row + row];
                 if (ev->frequency > 0.0f) {
                     /* trigger channel */
                     audio_set_channel(ch, ev->frequency, ev->instr);
@@ -141,10 +181,11 @@ static void sequencer_advance_tick(Sequencer *s) {
                     s->channel_remaining_ticks[ch] = ev->length_ticks;
                 }
                 s->channel_pos[ch]++; /* advance this channel's pointer */
-            } else {
-                /* channel finished this pattern: stop channel */
+            } else if (!s->channel_idle[ch]) {
+                /* channel finished this pattern: stop channel, once */
                 audio_stop_channel(ch);
                 s->channel_remaining_ticks[ch] = 0;
+                s->channel_idle[ch] = 1;
             }
         } else {
             /* This channel is currently sustaining a note; decrement later */
@@ -163,12 +204,12 @@ static void sequencer_advance_tick(Sequencer *s) {
     }
     if (all_done) {
         s->order_index++;
-        if (s->order_index < s->order_length) {
-            s->current_pattern_id = s->order[s->order_index];
+        if (enter_order_entry(s)) {
             /* reset channel positions for next pattern */
             for (int ch = 0; ch < DAWN_CHANNELS; ch++) {
                 s->channel_pos[ch] = 0;
                 s->channel_remaining_ticks[ch] = 0;
+                s->channel_idle[ch] = 0;
             }
         } else {
             /* no more patterns: stop */
@@ -177,15 +218,36 @@ static void sequencer_advance_tick(Sequencer *s) {
     }
 }
 
-/* Blocking runner: runs until sequencer stops */
+/* Ticks from now on which no channel does anything: every channel is
+   holding a note (or idle past its rows), so those ticks would only count
+   down channel_remaining_ticks */
+static int quiet_ticks(const Sequencer *s) {
+    int quiet = INT32_MAX;
+    for (int ch = 0; ch < DAWN_CHANNELS; ch++) {
+        if (s->channel_idle[ch]) continue;
+        if (s->channel_remaining_ticks[ch] < quiet) quiet = s->channel_remaining_ticks[ch];
+    }
+    return quiet == INT32_MAX ? 0 : quiet;
+}
+
+/* Blocking runner: runs until sequencer stops. Tick n is due n ticks after
+   the start on the monotonic clock; the runner sleeps straight to the next
+   tick on which some channel changes and counts the quiet ticks down in
+   one step, so a held note costs one wakeup and oversleeping never
+   accumulates into tempo drift. */
 void sequencer_run_blocking(Sequencer *s) {
     if (!s) return;
     if (!s->is_playing) sequencer_start(s);
-    double tick_seconds = s->seconds_per_tick;
+    double tick_ns = s->seconds_per_tick * 1e9;
+    uint64_t start = monotonic_ns();
+    uint64_t tick = 0;
 
-    /* Use a loop with precise_sleep */
     while (s->is_playing) {
-        precise_sleep(tick_seconds);
+        int quiet = quiet_ticks(s);
+        for (int ch = 0; ch < DAWN_CHANNELS; ch++)
+            if (!s->channel_idle[ch]) s->channel_remaining_ticks[ch] -= quiet;
+        tick += (uint64_t)quiet + 1;
+        sleep_until_ns(start + (uint64_t)((double)tick * tick_ns));
         sequencer_advance_tick(s);
     }
 }
@@ -217,11 +279,11 @@ NoteEvent make_rest(const char *len_token) {
     return e;
 }
 
-/* Convert a note name (e.g., C4, C-4, D#3, A4) to frequency in Hz.
-   Returns 0 for invalid names.
+/* Convert a note name (e.g., C4, C-4, D#3, A4) to a MIDI note number
+   (C4 => 60). Returns -1 for invalid names.
 */
-float note_name_to_freq(const char *name) {
-    if (!name || name[0] == '\0') return 0.0f;
+int note_name_to_midi(const char *name) {
+    if (!name || name[0] == '\0') return -1;
 
     /* parse note letter */
     char note = 0;
@@ -258,13 +320,34 @@ float note_name_to_freq(const char *name) {
         case 'G': note_base = 7; break;
         case 'A': note_base = 9; break;
         case 'B': note_base = 11; break;
-        default: return 0.0f;
+        default: return -1;
     }
+    if (octave < 0 || octave > 99) return -1;
 
     int semitone = note_base + accidental;
-    /* MIDI number for this note: MIDI = (octave+1)*12 + semitone
-       (C4 => MIDI 60) */
-    int midi = (octave + 1) * 12 + semitone;
-    double freq = 440.0 * pow(2.0, (midi - 69) / 12.0);
-    return (float)freq;
+    /* MIDI number for this note: MIDI = (octave+1)*12 + semitone */
+    return (octave + 1) * 12 + semitone;
+}
+
+/* equal-temperament frequencies for every note number a DawnNote can hold */
+static float midi_freq_table[MIDI_FREQ_TABLE_SIZE];
+static pthread_once_t midi_freq_once = PTHREAD_ONCE_INIT;
+
+static void build_midi_freq_table(void) {
+    for (int m = 0; m < MIDI_FREQ_TABLE_SIZE; m++)
+        midi_freq_table[m] = (float)(440.0 * pow(2.0, (m - 69) / 12.0));
+}
+
+float midi_to_freq(int midi) {
+    if (midi >= 0 && midi < MIDI_FREQ_TABLE_SIZE) {
+        pthread_once(&midi_freq_once, build_midi_freq_table);
+        return midi_freq_table[midi];
+    }
+    return (float)(440.0 * pow(2.0, (midi - 69) / 12.0));
+}
+
+/* Convert a note name to frequency in Hz. Returns 0 for invalid names. */
+float note_name_to_freq(const char *name) {
+    int midi = note_name_to_midi(name);
+    return midi < 0 ? 0.0f : midi_to_freq(midi);
 }
@@ -0,0 +1,510 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "synth.h"
+#include "osc.h"
+#include "mix.h"
+
+#define CTL SYNTH_CONTROL_FRAMES
+
+/* Per-voice arrays, copied voice by voice into snapshots */
+#define VOICE_FIELD(name) { offsetof(Synth, name), sizeof(((Synth *)0)->name[0]) }
+static const struct {
+    size_t offset, size;
+} voice_fields[] = {
+    VOICE_FIELD(phase), VOICE_FIELD(phase_inc), VOICE_FIELD(frequency), VOICE_FIELD(instrument),
+    VOICE_FIELD(noise), VOICE_FIELD(started), VOICE_FIELD(channel), VOICE_FIELD(slot),
+    VOICE_FIELD(ctl_pos), VOICE_FIELD(age), VOICE_FIELD(base_inc), VOICE_FIELD(gain_from),
+    VOICE_FIELD(gain_to), VOICE_FIELD(volume), VOICE_FIELD(env_stage), VOICE_FIELD(finished),
+    VOICE_FIELD(env_from), VOICE_FIELD(env_level), VOICE_FIELD(attack_step), VOICE_FIELD(decay_step),
+    VOICE_FIELD(release_step), VOICE_FIELD(sustain), VOICE_FIELD(release), VOICE_FIELD(effect),
+    VOICE_FIELD(fx_a), VOICE_FIELD(fx_b), VOICE_FIELD(glide), VOICE_FIELD(glide_step),
+};
+#define VOICE_FIELD_COUNT (sizeof(voice_fields) / sizeof(voice_fields[0]))
+
+typedef struct {
+    uint64_t note_seq;
+    uint64_t stolen;
+    int32_t polyphony;
+    int32_t active_count;
+} SnapshotHeader;
+
+typedef enum {
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE,
+    ENV_DONE
+} EnvStage;
+
+/* Move voice v's envelope 'frames' on; 0 settles stages of zero length */
+static void env_advance(Synth *s, int v, float frames) {
+    float level = s->env_level[v];
+    for (bool moving = true; moving;) {
+        switch (s->env_stage[v]) {
+            case ENV_ATTACK: {
+                float step = s->attack_step[v];
+                if (step > 0.0f && level < 1.0f) {
+                    float need = (1.0f - level) / step;
+                    if (need > frames) { level += step * frames; moving = false; break; }
+                    frames -= need;
+                }
+                level = 1.0f;
+                s->env_stage[v] = ENV_DECAY;
+                break;
+            }
+            case ENV_DECAY: {
+                float step = s->decay_step[v];
+                if (step > 0.0f && level > s->sustain[v]) {
+                    float need = (level - s->sustain[v]) / step;
+                    if (need > frames) { level -= step * frames; moving = false; break; }
+                    frames -= need;
+                }
+                level = s->sustain[v];
+                s->env_stage[v] = ENV_SUSTAIN;
+                break;
+            }
+            case ENV_RELEASE: {
+                float step = s->release_step[v];
+                if (step > 0.0f && level > 0.0f) {
+                    float need = level / step;
+                    if (need > frames) { level -= step * frames; moving = false; break; }
+                }
+                level = 0.0f;
+                s->env_stage[v] = ENV_DONE;
+                moving = false;
+                break;
+            }
+            case ENV_SUSTAIN:
+                level = s->sustain[v];
+                moving = false;
+                break;
+            default:
+                level = 0.0f;
+                moving = false;
+                break;
+        }
+    }
+    s->env_level[v] = level;
+}
+
+/* Pitch of voice v for the control block starting now, in semitones from its note */
+static float pitch_offset(const Synth *s, int v) {
+    switch (s->effect[v]) {
+        case SYNTH_FX_PORTAMENTO:
+            return s->glide[v];
+        case SYNTH_FX_VIBRATO: {
+            double cycles = (double)s->fx_a[v] * (double)s->age[v] / s->sample_rate;
+            return s->fx_b[v] * sinf(6.2831853f * (float)(cycles - floor(cycles)));
+        }
+        case SYNTH_FX_ARPEGGIO:
+            switch (s->age[v] * SYNTH_ARPEGGIO_HZ / (uint64_t)s->sample_rate % 3) {
+                case 1: return s->fx_a[v];
+                case 2: return s->fx_b[v];
+            }
+            return 0.0f;
+    }
+    return 0.0f;
+}
+
+/* Evaluate voice v's envelope, volume and effect for the control block
+   starting now (ctl_pos == 0): the gain ramps from where the last block
+   left it to the level at the end of this one. */
+static void control_update(Synth *s, int v) {
+    s->gain_from[v] = s->gain_to[v];
+    s->env_from[v] = s->env_level[v];
+    env_advance(s, v, (float)CTL);
+    s->gain_to[v] = s->env_level[v] * s->volume[v];
+
+    float semitones = pitch_offset(s, v);
+    s->phase_inc[v] = semitones == 0.0f ? s->base_inc[v]
+        : osc_phase_inc(s->frequency[v] * exp2f(semitones / 12.0f), s->sample_rate);
+    if (s->effect[v] == SYNTH_FX_PORTAMENTO) {
+        /* glide for the next block; the slide is over once it crosses the note */
+        float next = s->glide[v] + s->glide_step[v] * (float)CTL;
+        s->glide[v] = (next > 0.0f) == (s->glide[v] > 0.0f) ? next : 0.0f;
+        if (s->glide[v] == 0.0f && s->phase_inc[v] == s->base_inc[v]) s->effect[v] = SYNTH_FX_NONE;
+    }
+}
+
+/* The current control block is over: start the next one, or mark the
+   voice finished if its release ended in it */
+static void control_next(Synth *s, int v) {
+    s->age[v] += CTL;
+    if (s->env_stage[v] == ENV_DONE) {
+        s->finished[v] = 1;
+        return;
+    }
+    s->ctl_pos[v] = 0;
+    control_update(s, v);
+}
+
+/* An event is about to change voice v mid-block: make the levels reached
+   so far the starting point, so the change ramps from where the sound is */
+static void control_interrupt(Synth *s, int v) {
+    float t = (float)s->ctl_pos[v];
+    s->env_level[v] = s->env_from[v] + (s->env_level[v] - s->env_from[v]) * t / (float)CTL;
+    s->gain_to[v] = s->gain_from[v] + (s->gain_to[v] - s->gain_from[v]) / (float)CTL * t;
+    s->age[v] += s->ctl_pos[v];
+    s->ctl_pos[v] = 0;
+}
+
+/* Control blocks of a static voice all come out the same, so it can be
+   rendered or skipped in one piece */
+static bool voice_static(const Synth *s, int v) {
+    return s->effect[v] == SYNTH_FX_NONE && s->env_stage[v] == ENV_SUSTAIN && s->gain_from[v] == s->gain_to[v];
+}
+
+static void osc_fill(Synth *s, int v, float *out, int n) {
+    uint32_t *phase = &s->phase[v];
+    uint32_t inc = s->phase_inc[v];
+
+    switch (s->instrument[v]) {
+        case INST_SINE:     osc_sine(out, n, phase, inc); break;
+        case INST_SQUARE:   osc_square(out, n, phase, inc); break;
+        case INST_TRIANGLE: osc_triangle(out, n, phase, inc); break;
+        case INST_SAW:      osc_saw(out, n, phase, inc); break;
+        case INST_NOISE:
+            osc_noise(out, n, &s->noise[v]);
+            *phase += (uint32_t)n * inc;
+            break;
+    }
+}
+
+/* Fill one block of a single voice: the instrument switch runs once per
+   block, envelope and effects once per control block */
+static void render_voice(Synth *s, int v, float *out, int n) {
+    while (n > 0) {
+        if (s->finished[v]) {
+            memset(out, 0, sizeof(float) * (size_t)n);
+            return;
+        }
+        if (voice_static(s, v)) {
+            osc_fill(s, v, out, n);
+            if (s->gain_to[v] != 1.0f) mix_ramp(out, n, s->gain_to[v], 0.0f, 0);
+            s->ctl_pos[v] = (uint16_t)((s->ctl_pos[v] + n) % CTL);
+            s->age[v] += (uint64_t)n;
+            return;
+        }
+        int pos = s->ctl_pos[v];
+        int piece = n < CTL - pos ? n : CTL - pos;
+        osc_fill(s, v, out, piece);
+        float g0 = s->gain_from[v], g1 = s->gain_to[v];
+        if (g0 != 1.0f || g1 != 1.0f) mix_ramp(out, piece, g0, (g1 - g0) / (float)CTL, pos + 1);
+        s->ctl_pos[v] = (uint16_t)(pos + piece);
+        if (s->ctl_pos[v] == CTL) control_next(s, v);
+        out += piece;
+        n -= piece;
+    }
+}
+
+/* render_voice() without the samples */
+static void skip_voice(Synth *s, int v, uint64_t frames) {
+    while (frames > 0 && !s->finished[v]) {
+        uint64_t piece = frames;
+        if (!voice_static(s, v) && piece > (uint64_t)(CTL - s->ctl_pos[v])) piece = (uint64_t)(CTL - s->ctl_pos[v]);
+        /* both wrap mod 2^32, as they do sample by sample */
+        s->phase[v] += (uint32_t)piece * s->phase_inc[v];
+        if (s->instrument[v] == INST_NOISE) s->noise[v].counter += (uint32_t)piece;
+        if (voice_static(s, v)) {
+            s->ctl_pos[v] = (uint16_t)((s->ctl_pos[v] + piece) % CTL);
+            s->age[v] += piece;
+            return;
+        }
+        s->ctl_pos[v] = (uint16_t)(s->ctl_pos[v] + piece);
+        if (s->ctl_pos[v] == CTL) control_next(s, v);
+        frames -= piece;
+    }
+}
+
+void synth_init(Synth *s, int sample_rate) {
+    if (!s) return;
+    osc_init();
+    memset(s, 0, sizeof(*s));
+    s->sample_rate = sample_rate > 0 ? sample_rate : SYNTH_SAMPLE_RATE;
+    for (int i = 0; i < SYNTH_MAX_VOICES; i++) s->instrument[i] = INST_SINE;
+    memset(s->slot_voice, 0xff, sizeof(s->slot_voice));
+    synth_set_polyphony(s, SYNTH_MAX_VOICES);
+}
+
+void synth_set_polyphony(Synth *s, int voices) {
+    if (!s) return;
+    if (voices < 1) voices = 1;
+    if (voices > SYNTH_MAX_VOICES) voices = SYNTH_MAX_VOICES;
+    s->polyphony = voices;
+    /* lowest voice first, so allocation order is easy to follow */
+    s->free_count = 0;
+    for (int v = voices - 1; v >= 0; v--) s->free_voices[s->free_count++] = (uint16_t)v;
+}
+
+uint32_t synth_noise_seed(uint32_t song_seed, int channel, int slot) {
+    return song_seed ^ (0x9e3779b9u * (uint32_t)(channel + 1)) ^ (0x85ebca6bu * (uint32_t)slot);
+}
+
+/* mix order: (channel, slot, note-on order) */
+static bool voice_before(const Synth *s, int a, int b) {
+    if (s->channel[a] != s->channel[b]) return s->channel[a] < s->channel[b];
+    if (s->slot[a] != s->slot[b]) return s->slot[a] < s->slot[b];
+    return s->started[a] < s->started[b];
+}
+
+static void activate(Synth *s, int v) {
+    int i = s->active_count++;
+    while (i > 0 && voice_before(s, v, s->active[i - 1])) {
+        s->active[i] = s->active[i - 1];
+        i--;
+    }
+    s->active[i] = (uint16_t)v;
+}
+
+/* Silence voice v and return it to the pool */
+static void release_voice(Synth *s, int v) {
+    int i = 0;
+    while (i < s->active_count && s->active[i] != v) i++;
+    if (i == s->active_count) return;
+    memmove(&s->active[i], &s->active[i + 1], sizeof(s->active[0]) * (size_t)(s->active_count - i - 1));
+    s->active_count--;
+    if (s->slot_voice[s->channel[v]][s->slot[v]] == v) s->slot_voice[s->channel[v]][s->slot[v]] = -1;
+    s->free_voices[s->free_count++] = (uint16_t)v;
+}
+
+/* Stealing policy: when the pool is exhausted the released note that
+   started longest ago gives up its voice, or if none is fading out, the
+   note that started longest ago. */
+static int allocate_voice(Synth *s) {
+    if (s->free_count == 0) {
+        int victim = -1;
+        for (int i = 0; i < s->active_count; i++) {
+            int v = s->active[i];
+            if (s->env_stage[v] >= ENV_RELEASE && (victim < 0 || s->started[v] < s->started[victim])) victim = v;
+        }
+        if (victim < 0) {
+            victim = s->active[0];
+            for (int i = 1; i < s->active_count; i++)
+                if (s->started[s->active[i]] < s->started[victim]) victim = s->active[i];
+        }
+        release_voice(s, victim);
+        s->stolen++;
+    }
+    return s->free_voices[--s->free_count];
+}
+
+void synth_note_on(Synth *s, int id, int slot, float freq, Instrument inst, uint32_t seed, const SynthNote *note) {
+    static const SynthNote plain = SYNTH_NOTE_PLAIN;
+    if (!s || id < 0 || id >= SYNTH_CHANNELS || slot < 0 || slot >= SYNTH_CHORD_SLOTS) return;
+    if (!note) note = &plain;
+    uint32_t inc = osc_phase_inc(freq, s->sample_rate);
+    int v = s->slot_voice[id][slot];
+    bool fresh = v < 0;
+    if (!fresh) {
+        /* retune in place: the waveform carries on without a phase jump, and
+           consecutive noise notes continue one stream instead of repeating a burst */
+        if (inst == INST_NOISE && s->instrument[v] != INST_NOISE) osc_noise_seed(&s->noise[v], seed);
+        control_interrupt(s, v);
+        bool retune = freq != s->frequency[v] || inst != s->instrument[v];
+        s->glide[v] = 0.0f;
+        if (retune && note->effect == SYNTH_FX_PORTAMENTO && s->phase_inc[v] > 0 && inc > 0)
+            s->glide[v] = 12.0f * log2f((float)s->phase_inc[v] / (float)inc);
+        else if (retune)
+            s->env_stage[v] = ENV_ATTACK;
+    } else {
+        v = allocate_voice(s);
+        s->phase[v] = 0;
+        s->channel[v] = (uint8_t)id;
+        s->slot[v] = (uint8_t)slot;
+        if (inst == INST_NOISE) osc_noise_seed(&s->noise[v], seed);
+        s->slot_voice[id][slot] = (int16_t)v;
+        s->env_stage[v] = ENV_ATTACK;
+        s->env_level[v] = 0.0f;
+        s->glide[v] = 0.0f;
+        s->finished[v] = 0;
+    }
+    float rate = (float)s->sample_rate;
+    s->frequency[v] = freq;
+    s->base_inc[v] = inc;
+    s->instrument[v] = inst;
+    s->volume[v] = note->volume;
+    s->sustain[v] = note->sustain;
+    s->attack_step[v] = note->attack > 0.0f ? 1.0f / (note->attack * rate) : 0.0f;
+    s->decay_step[v] = note->decay > 0.0f ? (1.0f - note->sustain) / (note->decay * rate) : 0.0f;
+    s->release[v] = note->release;
+    s->effect[v] = (uint8_t)note->effect;
+    s->fx_a[v] = note->fx_a;
+    s->fx_b[v] = note->fx_b;
+    s->glide_step[v] = note->effect == SYNTH_FX_PORTAMENTO && note->fx_a > 0.0f ? -s->glide[v] / (note->fx_a * rate) : 0.0f;
+    if (s->glide_step[v] == 0.0f) s->glide[v] = 0.0f;
+
+    /* stages of zero length take effect now: a plain note starts at full level */
+    env_advance(s, v, 0.0f);
+    if (fresh) s->gain_to[v] = s->env_level[v] * s->volume[v];
+    s->age[v] = 0;
+    s->ctl_pos[v] = 0;
+    control_update(s, v);
+
+    /* a slot holds one note, so a retuned voice keeps its place in the list */
+    s->started[v] = ++s->note_seq;
+    if (fresh) activate(s, v);
+}
+
+void synth_note_off(Synth *s, int id, int slot) {
+    if (!s || id < 0 || id >= SYNTH_CHANNELS || slot < 0 || slot >= SYNTH_CHORD_SLOTS) return;
+    int v = s->slot_voice[id][slot];
+    if (v < 0) return;
+    if (s->release[v] <= 0.0f) {
+        release_voice(s, v);
+        return;
+    }
+    /* fade out from where the envelope is; the slot is free for the next note */
+    control_interrupt(s, v);
+    s->env_stage[v] = ENV_RELEASE;
+    s->release_step[v] = s->env_level[v] / (s->release[v] * (float)s->sample_rate);
+    s->slot_voice[id][slot] = -1;
+    control_update(s, v);
+}
+
+void synth_set_channel(Synth *s, int id, float freq, Instrument inst) {
+    synth_set_channel_seeded(s, id, freq, inst, synth_noise_seed(0, id, 0));
+}
+
+void synth_set_channel_seeded(Synth *s, int id, float freq, Instrument inst, uint32_t seed) {
+    synth_note_on(s, id, 0, freq, inst, seed, NULL);
+}
+
+void synth_stop_channel(Synth *s, int id) {
+    for (int slot = 0; slot < SYNTH_CHORD_SLOTS; slot++) synth_note_off(s, id, slot);
+}
+
+void synth_apply_event(Synth *s, const SynthEvent *ev) {
+    if (!ev) return;
+    if (ev->type == SYNTH_EV_NOTE_ON)
+        synth_note_on(s, ev->channel, ev->slot, ev->frequency, ev->instrument, ev->seed, &ev->note);
+    else if (ev->type == SYNTH_EV_RESTORE) synth_restore(s, ev->state);
+    else if (ev->slot < 0) synth_stop_channel(s, ev->channel);
+    else synth_note_off(s, ev->channel, ev->slot);
+}
+
+void synth_render(Synth *s, float *out, int frames) {
+    const float *rows[SYNTH_MIX_GROUP];
+    for (int g = 0; g < SYNTH_MIX_GROUP; g++) rows[g] = s->block[g];
+
+    for (int base = 0, n; base < frames; base += n) {
+        n = synth_span(s, frames - base < SYNTH_BLOCK_FRAMES ? frames - base : SYNTH_BLOCK_FRAMES);
+
+        if (s->active_count == 0) {
+            mix_sum(out + base, rows, 0, n, SYNTH_GAIN);
+            continue;
+        }
+        /* a group of voices at a time keeps the scratch rows in L1 */
+        for (int first = 0; first < s->active_count; first += SYNTH_MIX_GROUP) {
+            int count = s->active_count - first < SYNTH_MIX_GROUP ? s->active_count - first : SYNTH_MIX_GROUP;
+            if (s->muted) {
+                int heard = 0;
+                for (int g = 0; g < count; g++) {
+                    int v = s->active[first + g];
+                    if (s->muted >> s->channel[v] & 1u) skip_voice(s, v, (uint64_t)n);
+                    else render_voice(s, v, s->block[heard++], n);
+                }
+                count = heard;
+            } else {
+                for (int g = 0; g < count; g++) render_voice(s, s->active[first + g], s->block[g], n);
+            }
+            if (first == 0) mix_sum(out + base, rows, count, n, SYNTH_GAIN);
+            else mix_sum_add(out + base, rows, count, n, SYNTH_GAIN);
+        }
+        synth_reap(s);
+    }
+}
+
+void synth_skip(Synth *s, uint64_t frames) {
+    for (int i = 0; i < s->active_count; i++) skip_voice(s, s->active[i], frames);
+    synth_reap(s);
+}
+
+void synth_render_voice(Synth *s, int index, float *out, int frames) {
+    if (index < 0 || index >= s->active_count) return;
+    render_voice(s, s->active[index], out, frames);
+}
+
+int synth_span(const Synth *s, int frames) {
+    /* a voice whose envelope reached the end finishes with its control block */
+    for (int i = 0; i < s->active_count; i++) {
+        int v = s->active[i];
+        if (s->env_stage[v] == ENV_DONE && !s->finished[v] && CTL - s->ctl_pos[v] < frames)
+            frames = CTL - s->ctl_pos[v];
+    }
+    return frames;
+}
+
+void synth_reap(Synth *s) {
+    for (int i = s->active_count - 1; i >= 0; i--)
+        if (s->finished[s->active[i]]) release_voice(s, s->active[i]);
+}
+
+/* bytes per voice: a 'holds its slot' flag, then every voice field */
+static size_t voice_record_size(void) {
+    size_t n = 1;
+    for (size_t f = 0; f < VOICE_FIELD_COUNT; f++) n += voice_fields[f].size;
+    return n;
+}
+
+size_t synth_snapshot_size(const Synth *s) {
+    return sizeof(SnapshotHeader) + (size_t)s->active_count * voice_record_size();
+}
+
+void synth_snapshot(const Synth *s, void *buf) {
+    SnapshotHeader h = { s->note_seq, s->stolen, s->polyphony, s->active_count };
+    unsigned char *p = buf;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    for (int i = 0; i < s->active_count; i++) {
+        int v = s->active[i];
+        *p++ = s->slot_voice[s->channel[v]][s->slot[v]] == v;
+        for (size_t f = 0; f < VOICE_FIELD_COUNT; f++) {
+            memcpy(p, (const unsigned char *)s + voice_fields[f].offset + (size_t)v * voice_fields[f].size,
+                voice_fields[f].size);
+            p += voice_fields[f].size;
+        }
+    }
+}
+
+void synth_restore(Synth *s, const void *snapshot) {
+    if (!s || !snapshot) return;
+    SnapshotHeader h;
+    const unsigned char *p = snapshot;
+    memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+
+    /* the active list is in mix order already: voice i takes pool entry i */
+    memset(s->slot_voice, 0xff, sizeof(s->slot_voice));
+    for (int v = 0; v < h.active_count; v++) {
+        bool held = *p++;
+        for (size_t f = 0; f < VOICE_FIELD_COUNT; f++) {
+            memcpy((unsigned char *)s + voice_fields[f].offset + (size_t)v * voice_fields[f].size, p,
+                voice_fields[f].size);
+            p += voice_fields[f].size;
+        }
+        s->active[v] = (uint16_t)v;
+        if (held) s->slot_voice[s->channel[v]][s->slot[v]] = (int16_t)v;
+    }
+    s->active_count = h.active_count;
+    s->polyphony = h.polyphony;
+    s->note_seq = h.note_seq;
+    s->stolen = h.stolen;
+    s->free_count = 0;
+    for (int v = s->polyphony - 1; v >= s->active_count; v--) s->free_voices[s->free_count++] = (uint16_t)v;
+}
+
+void synth_renumber(Synth *s) {
+    uint16_t order[SYNTH_MAX_VOICES];
+    int n = s->active_count;
+    /* sounding voices by note-on order; insertion sort, the list is short */
+    for (int i = 0; i < n; i++) {
+        uint16_t v = s->active[i];
+        int j = i;
+        for (; j > 0 && s->started[order[j - 1]] > s->started[v]; j--) order[j] = order[j - 1];
+        order[j] = v;
+    }
+    for (int i = 0; i < n; i++) s->started[order[i]] = (uint64_t)i + 1;
+    s->note_seq = (uint64_t)n;
+}
@@ -0,0 +1,178 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tempo.h"
+
+/* A change placed on the song's tick axis */
+typedef struct {
+    uint64_t tick;
+    int index;              /* position in the file: ties apply in file order */
+    const DawnTempoChange *change;
+} PlacedChange;
+
+static int cmp_placed(const void *a, const void *b) {
+    const PlacedChange *x = a, *y = b;
+    if (x->tick != y->tick) return x->tick < y->tick ? -1 : 1;
+    return x->index - y->index;
+}
+
+/* BPM per tick of a ramp segment */
+static double ramp_slope(const TempoSegment *s) {
+    return (s->to - s->from) / (double)s->ramp_ticks;
+}
+
+/* Frames from the start of segment s to 'ticks' ticks into it. A held
+   tempo is an exact fraction (frames per tick = rate * 60 / (bpm * tpb)),
+   rounded once, so rounding never accumulates. A ramp integrates the
+   tick length 60 / (tpb * bpm(x)) seconds, bpm(x) = from + slope * x. */
+static uint64_t segment_frames(const TempoMap *m, const TempoSegment *s, uint64_t ticks) {
+    if (s->ramp_ticks == 0) {
+        uint64_t num = (uint64_t)m->sample_rate * 60;
+        uint64_t den = (uint64_t)s->to * (uint64_t)m->ticks_per_beat;
+        return (ticks * num + den / 2) / den;
+    }
+    double slope = ramp_slope(s);
+    double ticks_per_bpm = slope != 0.0 ? log1p(slope * (double)ticks / s->from) / slope : (double)ticks / s->from;
+    double minutes = ticks_per_bpm / m->ticks_per_beat;
+    return (uint64_t)(minutes * 60.0 * m->sample_rate + 0.5);
+}
+
+/* Tempo 'ticks' ticks into segment s */
+static double segment_bpm(const TempoSegment *s, uint64_t ticks) {
+    if (s->ramp_ticks == 0 || ticks >= s->ramp_ticks) return s->to;
+    return s->from + ramp_slope(s) * (double)ticks;
+}
+
+static bool push_segment(TempoMap *m, int *cap, const TempoSegment *s) {
+    if (m->count == *cap) {
+        int ncap = *cap ? *cap * 2 : 16;
+        TempoSegment *n = realloc(m->segments, sizeof(TempoSegment) * (size_t)ncap);
+        if (!n) return false;
+        m->segments = n;
+        *cap = ncap;
+    }
+    m->segments[m->count++] = *s;
+    return true;
+}
+
+/* Start a segment at 'tick' (>= the last segment's start), replacing the
+   last one if it starts there too */
+static TempoSegment *begin_segment(TempoMap *m, int *cap, uint64_t tick) {
+    TempoSegment *last = &m->segments[m->count - 1];
+    if (last->tick == tick) return last;
+    TempoSegment s = *last;
+    s.frame = last->frame + segment_frames(m, last, tick - last->tick);
+    s.from = s.to = segment_bpm(last, tick - last->tick);
+    s.tick = tick;
+    s.ramp_ticks = 0;
+    return push_segment(m, cap, &s) ? &m->segments[m->count - 1] : NULL;
+}
+
+/* A ramp that has run its course before 'tick' holds its final tempo from there */
+static bool end_ramp_before(TempoMap *m, int *cap, uint64_t tick) {
+    const TempoSegment *last = &m->segments[m->count - 1];
+    if (last->ramp_ticks == 0 || last->tick + last->ramp_ticks > tick) return true;
+    TempoSegment *s = begin_segment(m, cap, last->tick + last->ramp_ticks);
+    if (!s) return false;
+    s->ramp_ticks = 0;
+    return true;
+}
+
+bool tempo_map_build(TempoMap *m, const DawnSong *song, const uint64_t *order_ticks, int sample_rate) {
+    memset(m, 0, sizeof(*m));
+    m->sample_rate = sample_rate;
+    m->ticks_per_beat = song->ticks_per_beat > 0 ? song->ticks_per_beat : 4;
+    int bpm = song->bpm > 0 ? song->bpm : 120;
+
+    int n = 0, cap = 0;
+    size_t changes = song->tempo_change_count > 0 ? (size_t)song->tempo_change_count : 1;
+    PlacedChange *placed = malloc(sizeof(PlacedChange) * changes);
+    TempoSegment first = { 0, 0, (double)bpm, (double)bpm, 0 };
+    bool ok = placed && push_segment(m, &cap, &first);
+    for (int i = 0; ok && i < song->tempo_change_count; i++) {
+        const DawnTempoChange *c = &song->tempo_changes[i];
+        /* the loader checks entries against ORDER; stay defensive */
+        if (c->order >= (uint32_t)song->order_length || c->bpm == 0) continue;
+        placed[n++] = (PlacedChange){ order_ticks[c->order] + c->tick, i, c };
+    }
+    if (ok) qsort(placed, (size_t)n, sizeof(PlacedChange), cmp_placed);
+
+    for (int i = 0; ok && i < n; i++) {
+        const DawnTempoChange *c = placed[i].change;
+        TempoSegment *s = NULL;
+        ok = end_ramp_before(m, &cap, placed[i].tick) && (s = begin_segment(m, &cap, placed[i].tick)) != NULL;
+        if (!ok) break;
+        /* a ramp starts from the tempo reached there (which a change at the
+           same tick may just have set), a step replaces it */
+        s->to = (double)c->bpm;
+        s->ramp_ticks = c->ramp_ticks;
+        if (c->ramp_ticks == 0) s->from = s->to;
+    }
+    if (ok) ok = end_ramp_before(m, &cap, UINT64_MAX);
+
+    free(placed);
+    if (!ok) {
+        fprintf(stderr, "dawn: out of memory compiling the tempo map\n");
+        tempo_map_free(m);
+        return false;
+    }
+    return true;
+}
+
+void tempo_map_free(TempoMap *m) {
+    if (!m) return;
+    free(m->segments);
+    m->segments = NULL;
+    m->count = 0;
+}
+
+/* Last segment starting at or before 'tick' */
+static const TempoSegment *segment_at_tick(const TempoMap *m, uint64_t tick) {
+    int lo = 0, hi = m->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (m->segments[mid].tick <= tick) lo = mid;
+        else hi = mid - 1;
+    }
+    return &m->segments[lo];
+}
+
+uint64_t tempo_frame(const TempoMap *m, uint64_t tick) {
+    const TempoSegment *s = segment_at_tick(m, tick);
+    return s->frame + segment_frames(m, s, tick - s->tick);
+}
+
+double tempo_tick(const TempoMap *m, uint64_t frame) {
+    int lo = 0, hi = m->count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (m->segments[mid].frame <= frame) lo = mid;
+        else hi = mid - 1;
+    }
+    const TempoSegment *s = &m->segments[lo];
+    double ticks_per_bpm = (double)(frame - s->frame) / m->sample_rate / 60.0 * m->ticks_per_beat;
+    double ticks;
+    if (s->ramp_ticks == 0) {
+        ticks = ticks_per_bpm * s->to;
+    } else {
+        /* invert segment_frames() */
+        double slope = ramp_slope(s);
+        ticks = slope != 0.0 ? s->from / slope * expm1(slope * ticks_per_bpm) : ticks_per_bpm * s->from;
+    }
+    /* the next segment starts where it starts, whatever the rounding */
+    if (lo + 1 < m->count && (double)s->tick + ticks > (double)m->segments[lo + 1].tick)
+        return (double)m->segments[lo + 1].tick;
+    return (double)s->tick + ticks;
+}
+
+double tempo_tick_seconds(const TempoMap *m, uint64_t tick) {
+    const TempoSegment *s = segment_at_tick(m, tick);
+    if (s->ramp_ticks == 0) {
+        /* as a song without tempo changes has always timed its effects */
+        uint64_t num = (uint64_t)m->sample_rate * 60;
+        uint64_t den = (uint64_t)s->to * (uint64_t)m->ticks_per_beat;
+        return (double)num / (double)den / (double)m->sample_rate;
+    }
+    return 60.0 / (segment_bpm(s, tick - s->tick) * m->ticks_per_beat);
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timeline.h"
+
+_Static_assert(DAWN_MAX_CHANNELS <= SYNTH_CHANNELS, "song channels must fit the synth");
+_Static_assert(DAWN_MAX_CHORD <= SYNTH_CHORD_SLOTS, "chords must fit the synth's slots");
+
+typedef struct {
+    uint64_t tick;
+    float frequency;
+    int channel;
+    int slot;
+    Instrument instrument;
+    uint8_t volume, effect, param;
+} PendingEvent;
+
+typedef struct {
+    TimelineEvent *events;
+    int count;
+    int cap;
+} EventVec;
+
+static bool push_event(EventVec *v, const TimelineEvent *ev) {
+    if (v->count == v->cap) {
+        int cap = v->cap ? v->cap * 2 : 1024;
+        TimelineEvent *e = realloc(v->events, sizeof(TimelineEvent) * (size_t)cap);
+        if (!e) return false;
+        v->events = e;
+        v->cap = cap;
+    }
+    v->events[v->count++] = *ev;
+    return true;
+}
+
+static int cmp_pending(const void *a, const void *b) {
+    const PendingEvent *x = a, *y = b;
+    if (x->tick != y->tick) return x->tick < y->tick ? -1 : 1;
+    if (x->channel != y->channel) return x->channel - y->channel;
+    return x->slot - y->slot;
+}
+
+/* Ticks a row lasts; rows without a length last one tick */
+static uint64_t row_ticks(const DawnNote *row) {
+    return row->length_ticks > 0 ? (uint64_t)row->length_ticks : 1;
+}
+
+/* What a row sounds like; frequency 0 for a rest */
+static void row_sound(const DawnNote *row, PendingEvent *pe) {
+    Instrument inst = DAWN_ROW_INSTR(row);
+    if (inst == INST_NOISE) {
+        pe->frequency = 440.0f; /* noise ignores pitch */
+        pe->instrument = INST_NOISE;
+    } else {
+        pe->frequency = row->note != DAWN_NOTE_REST ? midi_to_freq(row->note) : 0.0f;
+        pe->instrument = inst;
+    }
+    /* rows of a mapped .dawnc are not range-checked on load */
+    pe->volume = row->volume <= DAWN_VOLUME_MAX ? row->volume : DAWN_VOLUME_MAX;
+    pe->effect = row->effect <= DAWN_FX_ARPEGGIO ? row->effect : DAWN_FX_NONE;
+    pe->param = pe->effect != DAWN_FX_NONE ? row->param : 0;
+}
+
+/* Ticks a pattern lasts: its longest channel, and at least one tick */
+static uint64_t pattern_ticks(const DawnSong *song, const DawnPattern *pat) {
+    uint64_t length = 1;
+    for (int c = 0; c < song->channel_count; c++) {
+        uint32_t row_count;
+        const DawnNote *rows = dawn_pattern_rows(song, pat, c, &row_count);
+        uint64_t t = 0;
+        for (uint32_t r = 0; r < row_count; r++)
+            if (r == 0 || !(rows[r].instr & DAWN_ROW_CHORD)) t += row_ticks(&rows[r]);
+        if (t > length) length = t;
+    }
+    return length;
+}
+
+static void silent_sound(PendingEvent *pe) {
+    pe->frequency = 0.0f;
+    pe->instrument = INST_SINE;
+    pe->volume = DAWN_VOLUME_MAX;
+    pe->effect = DAWN_FX_NONE;
+    pe->param = 0;
+}
+
+bool timeline_compile(const DawnSong *song, int sample_rate, Timeline *out) {
+    if (!song || !out) return false;
+    memset(out, 0, sizeof(*out));
+    out->sample_rate = sample_rate > 0 ? sample_rate : SYNTH_SAMPLE_RATE;
+    out->channel_count = song->channel_count;
+    out->seed = song->seed;
+
+    /* A row of m notes sets slots 0..m-1 and stops any slot the row before
+       it used beyond that, so a channel yields at most two events per row,
+       plus a full set of slots at its start and end. Size for the largest pattern. */
+    size_t pending_cap = 1;
+    for (int p = 0; p < song->pattern_count; p++) {
+        size_t n = (size_t)song->channel_count * 2 * DAWN_MAX_CHORD;
+        for (int c = 0; c < song->channel_count; c++) {
+            uint32_t rc;
+            dawn_pattern_rows(song, &song->patterns[p], c, &rc);
+            n += 2 * (size_t)rc;
+        }
+        if (n > pending_cap) pending_cap = n;
+    }
+    size_t order_cap = (size_t)(song->order_length > 0 ? song->order_length : 1);
+    PendingEvent *pending = malloc(sizeof(PendingEvent) * pending_cap);
+    uint64_t *order_frames = malloc(sizeof(uint64_t) * order_cap);
+    uint64_t *order_ticks = malloc(sizeof(uint64_t) * order_cap);
+    uint64_t *lengths = malloc(sizeof(uint64_t) * (size_t)(song->pattern_count > 0 ? song->pattern_count : 1));
+    EventVec vec = { NULL, 0, 0 };
+    if (!pending || !order_frames || !order_ticks || !lengths) {
+        fprintf(stderr, "dawn: out of memory compiling timeline\n");
+        free(pending);
+        free(order_frames);
+        free(order_ticks);
+        free(lengths);
+        return false;
+    }
+
+    /* where each ORDER entry starts in ticks, which places the tempo
+       changes; every tick -> frame conversion then goes through the map */
+    for (int p = 0; p < song->pattern_count; p++) lengths[p] = pattern_ticks(song, &song->patterns[p]);
+    uint64_t tick = 0;
+    for (int o = 0; o < song->order_length; o++) {
+        order_ticks[o] = tick;
+        const DawnPattern *pat = dawn_song_pattern(song, song->order[o]);
+        if (pat) tick += lengths[pat - song->patterns];
+    }
+    free(lengths);
+    if (!tempo_map_build(&out->tempo, song, order_ticks, out->sample_rate)) {
+        free(pending);
+        free(order_frames);
+        free(order_ticks);
+        return false;
+    }
+    const TempoMap *tempo = &out->tempo;
+
+    /* what each slot is doing, to drop changes that would be no-ops */
+    PendingEvent cur[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD];
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++)
+        for (int k = 0; k < DAWN_MAX_CHORD; k++) silent_sound(&cur[c][k]);
+
+    bool ok = true;
+    uint64_t base_tick = 0;
+    for (int o = 0; o < song->order_length && ok; o++) {
+        order_frames[o] = tempo_frame(tempo, base_tick);
+        const DawnPattern *pat = dawn_song_pattern(song, song->order[o]);
+        if (!pat) continue; /* rejected by the parser; stay defensive */
+
+        /* every channel restarts at row 0; a pattern lasts as long as its
+           longest channel, and at least one tick */
+        uint64_t length = 1;
+        uint64_t channel_end[DAWN_MAX_CHANNELS];
+        int channel_width[DAWN_MAX_CHANNELS];
+        int n = 0;
+        for (int c = 0; c < song->channel_count; c++) {
+            uint32_t row_count;
+            const DawnNote *rows = dawn_pattern_rows(song, pat, c, &row_count);
+            uint64_t t = 0;
+            int width = DAWN_MAX_CHORD; /* the previous pattern may have left any slot sounding */
+            for (uint32_t r = 0; r < row_count;) {
+                int m = 1;
+                while (r + (uint32_t)m < row_count && (rows[r + m].instr & DAWN_ROW_CHORD)) m++;
+                for (int k = 0; k < (m > width ? m : width); k++) {
+                    PendingEvent *pe = &pending[n++];
+                    pe->tick = t;
+                    pe->channel = c;
+                    pe->slot = k;
+                    if (k < m) row_sound(&rows[r + k], pe);
+                    else silent_sound(pe);
+                }
+                width = m;
+                t += row_ticks(&rows[r]);
+                r += (uint32_t)m;
+            }
+            channel_end[c] = t;
+            channel_width[c] = width;
+            if (t > length) length = t;
+        }
+        /* channels that run out of rows early fall silent there */
+        for (int c = 0; c < song->channel_count; c++) {
+            uint64_t t = channel_end[c];
+            if (t >= length) continue;
+            for (int k = 0; k < channel_width[c]; k++) {
+                PendingEvent *pe = &pending[n++];
+                pe->tick = t;
+                pe->channel = c;
+                pe->slot = k;
+                silent_sound(pe);
+            }
+        }
+        qsort(pending, (size_t)n, sizeof(PendingEvent), cmp_pending);
+
+        for (int i = 0; i < n && ok; i++) {
+            const PendingEvent *pe = &pending[i];
+            int c = pe->channel, k = pe->slot;
+            const PendingEvent *was = &cur[c][k];
+            if (pe->frequency == was->frequency &&
+                (pe->frequency == 0.0f || (pe->instrument == was->instrument && pe->volume == was->volume &&
+                                           pe->effect == was->effect && pe->param == was->param)))
+                continue;
+            cur[c][k] = *pe;
+
+            uint64_t at = base_tick + pe->tick;
+            TimelineEvent ev;
+            ev.frame = tempo_frame(tempo, at);
+            ev.frequency = pe->frequency;
+            ev.channel = (uint8_t)c;
+            ev.slot = (uint8_t)k;
+            ev.instrument = (uint8_t)pe->instrument;
+            ev.volume = pe->volume;
+            ev.effect = pe->effect;
+            ev.param = pe->param;
+            ev.glide = pe->effect == DAWN_FX_PORTAMENTO ? (float)(pe->param * tempo_tick_seconds(tempo, at)) : 0.0f;
+            ok = push_event(&vec, &ev);
+        }
+        base_tick += length;
+    }
+
+    uint64_t song_end = tempo_frame(tempo, base_tick);
+    for (int c = 0; c < song->channel_count && ok; c++) {
+        for (int k = 0; k < DAWN_MAX_CHORD && ok; k++) {
+            if (cur[c][k].frequency == 0.0f) continue;
+            TimelineEvent ev = { song_end, 0.0f, (uint8_t)c, (uint8_t)k, INST_SINE, DAWN_VOLUME_MAX, DAWN_FX_NONE, 0,
+                                 0.0f };
+            ok = push_event(&vec, &ev);
+        }
+    }
+    /* let the last notes ring out: a release ends within a control block of its length */
+    uint64_t tail = 0;
+    for (int c = 0; c < song->channel_count; c++) {
+        out->voices[c] = song->channel_voices[c];
+        uint64_t release = ((uint64_t)song->channel_voices[c].release_ms * (uint64_t)out->sample_rate + 999) / 1000;
+        if (release > 0 && release + SYNTH_CONTROL_FRAMES > tail) tail = release + SYNTH_CONTROL_FRAMES;
+    }
+    out->song_frames = song_end;
+    out->total_frames = song_end + tail;
+
+    free(pending);
+    if (!ok) {
+        fprintf(stderr, "dawn: out of memory compiling timeline\n");
+        free(vec.events);
+        free(order_frames);
+        free(order_ticks);
+        tempo_map_free(&out->tempo);
+        return false;
+    }
+    out->events = vec.events;
+    out->event_count = vec.count;
+    out->order_frames = order_frames;
+    out->order_ticks = order_ticks;
+    out->order_count = song->order_length;
+    return true;
+}
+
+void timeline_free(Timeline *t) {
+    if (!t) return;
+    free(t->events);
+    free(t->order_frames);
+    free(t->order_ticks);
+    tempo_map_free(&t->tempo);
+    t->events = NULL;
+    t->event_count = 0;
+    t->order_frames = NULL;
+    t->order_ticks = NULL;
+    t->order_count = 0;
+}
+
+void timeline_synth_event(const Timeline *t, const TimelineEvent *ev, uint64_t base_frame, SynthEvent *out) {
+    out->frame = base_frame + ev->frame;
+    out->type = ev->frequency > 0.0f ? SYNTH_EV_NOTE_ON : SYNTH_EV_NOTE_OFF;
+    out->channel = ev->channel;
+    out->slot = ev->slot;
+    out->frequency = ev->frequency;
+    out->instrument = (Instrument)ev->instrument;
+    out->seed = synth_noise_seed(t->seed, ev->channel, ev->slot);
+    out->state = NULL;
+
+    const DawnVoice *voice = &t->voices[ev->channel];
+    SynthNote *note = &out->note;
+    note->volume = (float)(voice->volume * ev->volume) / (float)(DAWN_VOLUME_MAX * DAWN_VOLUME_MAX);
+    note->attack = (float)voice->attack_ms / 1000.0f;
+    note->decay = (float)voice->decay_ms / 1000.0f;
+    note->sustain = (float)voice->sustain / (float)DAWN_VOLUME_MAX;
+    note->release = (float)voice->release_ms / 1000.0f;
+    note->fx_a = note->fx_b = 0.0f;
+    switch (ev->effect) {
+        case DAWN_FX_PORTAMENTO:
+            note->effect = SYNTH_FX_PORTAMENTO;
+            note->fx_a = ev->glide;
+            break;
+        case DAWN_FX_VIBRATO:
+            note->effect = SYNTH_FX_VIBRATO;
+            note->fx_a = (float)(ev->param >> 4);
+            note->fx_b = (float)(ev->param & 15) * 0.25f;
+            break;
+        case DAWN_FX_ARPEGGIO:
+            note->effect = SYNTH_FX_ARPEGGIO;
+            note->fx_a = (float)(ev->param >> 4);
+            note->fx_b = (float)(ev->param & 15);
+            break;
+        default:
+            note->effect = SYNTH_FX_NONE;
+            break;
+    }
+}
+
+int timeline_first_event(const Timeline *t, uint64_t frame) {
+    int lo = 0, hi = t->event_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (t->events[mid].frame < frame) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void timeline_slots_before(const Timeline *t, int first, TimelineEvent slots[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD]) {
+    bool seen[DAWN_MAX_CHANNELS][DAWN_MAX_CHORD];
+    memset(seen, 0, sizeof(seen));
+    for (int c = 0; c < DAWN_MAX_CHANNELS; c++) {
+        for (int k = 0; k < DAWN_MAX_CHORD; k++) {
+            TimelineEvent stop = { 0, 0.0f, (uint8_t)c, (uint8_t)k, INST_SINE, DAWN_VOLUME_MAX, DAWN_FX_NONE, 0, 0.0f };
+            slots[c][k] = stop;
+        }
+    }
+    /* walk back until every slot the song uses has turned up */
+    int missing = t->channel_count * DAWN_MAX_CHORD;
+    for (int i = first - 1; i >= 0 && missing > 0; i--) {
+        const TimelineEvent *ev = &t->events[i];
+        if (seen[ev->channel][ev->slot]) continue;
+        seen[ev->channel][ev->slot] = true;
+        slots[ev->channel][ev->slot] = *ev;
+        missing--;
+    }
+}
+
+bool timeline_same_sound(const TimelineEvent *a, const TimelineEvent *b) {
+    return a->frequency == b->frequency &&
+           (a->frequency == 0.0f || (a->instrument == b->instrument && a->volume == b->volume &&
+                                     a->effect == b->effect && a->param == b->param));
+}
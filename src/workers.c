@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "workers.h"
+
+/* A job is usually a few tens of microseconds, so idle workers poll for a
+   while before falling back to the condition variable. Only when every
+   thread has a CPU of its own: otherwise the poll keeps the thread it waits
+   for off the CPU. */
+#define WORKERS_SPIN 4000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+typedef struct {
+    WorkerPool *pool;
+    int index;
+} WorkerSlot;
+
+struct WorkerPool {
+    int count;
+    pthread_t threads[WORKERS_MAX];
+    WorkerSlot slots[WORKERS_MAX];
+    int started;                 /* threads actually created */
+    int spin;                    /* poll iterations before sleeping */
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    atomic_uint_fast64_t generation;  /* bumped once per job */
+    atomic_int remaining;        /* spawned workers still busy with the job */
+    atomic_bool quit;
+
+    WorkerFn fn;
+    void *arg;
+};
+
+int workers_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (int)n;
+}
+
+static uint_fast64_t wait_for_job(WorkerPool *pool, uint_fast64_t seen) {
+    for (int i = 0; i < pool->spin; i++) {
+        uint_fast64_t gen = atomic_load_explicit(&pool->generation, memory_order_acquire);
+        if (gen != seen || atomic_load_explicit(&pool->quit, memory_order_relaxed)) return gen;
+        cpu_relax();
+    }
+    pthread_mutex_lock(&pool->lock);
+    uint_fast64_t gen;
+    while ((gen = atomic_load_explicit(&pool->generation, memory_order_acquire)) == seen &&
+           !atomic_load_explicit(&pool->quit, memory_order_relaxed))
+        pthread_cond_wait(&pool->wake, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return gen;
+}
+
+static void *worker_main(void *p) {
+    WorkerSlot *slot = p;
+    WorkerPool *pool = slot->pool;
+    uint_fast64_t seen = 0;
+
+    for (;;) {
+        seen = wait_for_job(pool, seen);
+        if (atomic_load_explicit(&pool->quit, memory_order_relaxed)) break;
+        pool->fn(pool->arg, slot->index, pool->count);
+        if (atomic_fetch_sub_explicit(&pool->remaining, 1, memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+WorkerPool *workers_create(int threads) {
+    if (threads <= 0) threads = workers_cpu_count();
+    if (threads > WORKERS_MAX) threads = WORKERS_MAX;
+
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) return NULL;
+    pool->count = threads;
+    pool->spin = threads <= workers_cpu_count() ? WORKERS_SPIN : 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->remaining, 0);
+    atomic_init(&pool->quit, false);
+
+    for (int i = 1; i < threads; i++) {
+        pool->slots[i].pool = pool;
+        pool->slots[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->slots[i]) != 0) {
+            workers_destroy(pool);
+            return NULL;
+        }
+        pool->started++;
+    }
+    return pool;
+}
+
+void workers_destroy(WorkerPool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    atomic_store_explicit(&pool->quit, true, memory_order_relaxed);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i <= pool->started; i++) pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int workers_count(const WorkerPool *pool) {
+    return pool ? pool->count : 1;
+}
+
+void workers_run(WorkerPool *pool, WorkerFn fn, void *arg) {
+    if (pool->count == 1) {
+        fn(arg, 0, 1);
+        return;
+    }
+    pool->fn = fn;
+    pool->arg = arg;
+    atomic_store_explicit(&pool->remaining, pool->count - 1, memory_order_relaxed);
+    /* the release publishes fn/arg to the workers that see the new generation */
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    fn(arg, 0, pool->count);
+
+    for (int i = 0; i < pool->spin; i++) {
+        if (atomic_load_explicit(&pool->remaining, memory_order_acquire) == 0) return;
+        cpu_relax();
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load_explicit(&pool->remaining, memory_order_acquire) != 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}